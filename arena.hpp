@@ -0,0 +1,116 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// A bump allocator for syntax nodes. Memory is handed out from large blocks
+// and is only ever given back all at once by reset() or the destructor, so
+// nothing allocated here has its destructor run.
+struct arena {
+    struct block {
+        block* next;
+        size_t size;
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+    static constexpr size_t default_block_size = 64 * 1024;
+
+    // The arena syntax nodes are allocated from on this thread, or nullptr
+    // for plain new/delete. Use arena::scope to set it.
+    static thread_local arena* active;
+
+    struct scope {
+        arena* previous;
+        scope(arena* nodes) : previous(active) { active = nodes; }
+        ~scope() { active = previous; }
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+    };
+
+    block* head = nullptr;
+    char* position = nullptr;
+    char* end = nullptr;
+    size_t block_size = default_block_size;
+    size_t used = 0;
+
+    arena(size_t block_size = default_block_size) : block_size(block_size) {}
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+    arena(arena&& other) { *this = std::move(other); }
+    arena& operator=(arena&& other) {
+        release();
+        std::swap(head, other.head);
+        std::swap(position, other.position);
+        std::swap(end, other.end);
+        std::swap(block_size, other.block_size);
+        std::swap(used, other.used);
+        return *this;
+    }
+    ~arena() { release(); }
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        auto aligned = (char*)(((size_t)position + align - 1) & ~(align - 1));
+        if (!head || aligned + size > end) {
+            grow(size + align);
+            aligned = (char*)(((size_t)position + align - 1) & ~(align - 1));
+        }
+        position = aligned + size;
+        used += size;
+        return aligned;
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
+    }
+
+    // Drops everything allocated so far. Only the newest block is kept for
+    // reuse, so this costs one deallocation per extra block and nothing per node.
+    void reset() {
+        if (!head)
+            return;
+        auto rest = head->next;
+        head->next = nullptr;
+        free_blocks(rest);
+        position = head->data();
+        end = position + head->size;
+        used = 0;
+    }
+
+    size_t bytes_used() const { return used; }
+
+    size_t bytes_reserved() const {
+        size_t total = 0;
+        for (auto b = head; b; b = b->next)
+            total += b->size;
+        return total;
+    }
+
+private:
+    void grow(size_t min_size) {
+        size_t size = min_size > block_size ? min_size : block_size;
+        auto b = (block*)::operator new(sizeof(block) + size);
+        b->next = head;
+        b->size = size;
+        head = b;
+        position = b->data();
+        end = position + size;
+    }
+
+    static void free_blocks(block* b) {
+        while (b) {
+            auto next = b->next;
+            ::operator delete(b);
+            b = next;
+        }
+    }
+
+    void release() {
+        free_blocks(head);
+        head = nullptr;
+        position = end = nullptr;
+        used = 0;
+    }
+};
+
+thread_local arena* arena::active = nullptr;
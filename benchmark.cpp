@@ -0,0 +1,411 @@
+#include "parser.hpp"
+#include "corpus.hpp"
+#include "syntax_image.hpp"
+#include "parse_cache.hpp"
+#include "printer.hpp"
+#include "bytecode.hpp"
+#include "columnar.hpp"
+#include "parse_server.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+// Every allocation goes through here, so phases can report allocations per
+// statement. Counted per thread, so the server's threads do not race on it.
+// Each form of new and delete is replaced, so every block is allocated and
+// freed by the same pair.
+static thread_local size_t allocations = 0;
+
+static void* allocate(size_t size, size_t alignment) noexcept {
+    ++allocations;
+    size = size ? size : 1;
+    if (alignment <= alignof(std::max_align_t))
+        return std::malloc(size);
+    // aligned_alloc takes whole multiples of the alignment.
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+static void* allocate_or_throw(size_t size, size_t alignment) {
+    if (auto memory = allocate(size, alignment))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size) { return allocate_or_throw(size, 0); }
+void* operator new[](size_t size) { return allocate_or_throw(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocate_or_throw(size, size_t(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocate_or_throw(size, size_t(alignment)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, size_t(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, size_t(alignment)); }
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept { std::free(memory); }
+
+struct result {
+    size_t tokens = 0, statements = 0;
+};
+
+struct measurement {
+    double seconds = 1e300;
+    size_t allocations = 0;
+};
+
+// Runs a phase at least 5 times and for at least half a second, and keeps
+// the fastest run. Phases of a few milliseconds take many runs before their
+// memory is as fast as it gets, so a fixed count would time them cold.
+template <typename F>
+measurement measure(F run) {
+    using clock = std::chrono::steady_clock;
+    measurement best;
+    double total = 0;
+    for (int repetition = 0; repetition < 5 || total < 0.5; ++repetition) {
+        auto before = allocations;
+        auto start = clock::now();
+        run();
+        auto seconds = std::chrono::duration<double>(clock::now() - start).count();
+        total += seconds;
+        if (seconds < best.seconds)
+            best = {seconds, allocations - before};
+    }
+    return best;
+}
+
+void report(const char* phase, const char* kind, const std::string &input, const result &counts, measurement m) {
+    printf("%-18s %-12s %9.1f MB/s %12.0f tokens/s %11.0f statements/s %8.2f allocs/statement\n",
+        phase, kind,
+        input.size() / m.seconds / 1e6,
+        counts.tokens / m.seconds,
+        counts.statements / m.seconds,
+        counts.statements ? double(m.allocations) / counts.statements : 0.0
+    );
+}
+
+void benchmark(const char* kind, const std::string &input) {
+    result counts;
+
+    auto tokenize = measure([&] {
+        auto tokenizer = string_tokenizer::from_string(input);
+        counts.tokens = 0;
+        while (tokenizer.next().kind != token::END_OF_INPUT)
+            ++counts.tokens;
+    });
+
+    auto tokenize_symbols = measure([&] {
+        symbol_table symbols;
+        auto tokenizer = string_tokenizer::from_string(input, &symbols);
+        while (tokenizer.next().kind != token::END_OF_INPUT);
+    });
+
+    token_buffer tokens;
+    auto tokenize_buffer = measure([&] {
+        tokens.tokenize(input.data(), input.data() + input.size());
+    });
+
+    std::vector<syntax> statements;
+    auto parse = measure([&] {
+        statements = parser::from_string(input).parse_program();
+    });
+    counts.statements = statements.size();
+
+    auto nodes = std::make_shared<arena>();
+    auto parse_arena = measure([&] {
+        nodes->reset();
+        parser::from_string(input, nodes).parse_program();
+    });
+
+    auto parse_iterative = measure([&] {
+        nodes->reset();
+        auto parser = parser::from_string(input, nodes);
+        parser.iterative = true;
+        parser.parse_program();
+    });
+
+    auto parse_shared = measure([&] {
+        nodes->reset();
+        hash_cons shared;
+        auto parser = parser::from_string(input, nodes);
+        parser.shared = &shared;
+        parser.parse_program();
+    });
+
+    auto parse_buffer = measure([&] {
+        nodes->reset();
+        buffered_parser::from_tokens(token_buffer::cursor(tokens), nodes).parse_program();
+    });
+
+    // Line by line through a parse cache, as the REPL does with --memo.
+    auto parse_memo = measure([&] {
+        parse_cache memo;
+        std::string line;
+        for (size_t begin = 0, end; begin < input.size(); begin = end + 1) {
+            end = input.find('\n', begin);
+            end = end == std::string::npos ? input.size() : end;
+            line.assign(input, begin, end - begin);
+            memo.parse(line);
+        }
+    });
+
+    std::string image;
+    auto serialize = measure([&] {
+        image = syntax_image::serialize(statements, input.data(), input.data() + input.size(), {});
+    });
+
+    auto load = measure([&] {
+        auto loaded = syntax_image::view(image.data(), image.size());
+        if (!loaded.matches(input.data(), input.data() + input.size(), {}))
+            abort();
+    });
+
+    auto print = measure([&] {
+        std::ostringstream output;
+        for (auto& statement : statements)
+            output << statement << '\n';
+    });
+
+    auto print_buffer = measure([&] {
+        syntax_printer output;
+        for (auto& statement : statements)
+            output.line(statement);
+    });
+
+    auto print_json = measure([&] {
+        syntax_printer output(-1, syntax_printer::JSON);
+        for (auto& statement : statements)
+            output.line(statement);
+    });
+
+    report("tokenize", kind, input, counts, tokenize);
+    report("tokenize (intern)", kind, input, counts, tokenize_symbols);
+    report("tokenize (buffer)", kind, input, counts, tokenize_buffer);
+    report("parse", kind, input, counts, parse);
+    report("parse (arena)", kind, input, counts, parse_arena);
+    report("parse (iterative)", kind, input, counts, parse_iterative);
+    report("parse (shared)", kind, input, counts, parse_shared);
+    report("parse (buffer)", kind, input, counts, parse_buffer);
+    report("parse (memo)", kind, input, counts, parse_memo);
+    report("serialize", kind, input, counts, serialize);
+    report("load", kind, input, counts, load);
+    report("print", kind, input, counts, print);
+    report("print (buffer)", kind, input, counts, print_buffer);
+    report("print (json)", kind, input, counts, print_json);
+}
+
+// A per-row tree walk, the baseline for evaluating over columns. Variables
+// are read by symbol from one double column each.
+double walk(const syntax &ast, const std::vector<const double*> &columns, size_t row) {
+    switch (ast.kind) {
+        case syntax::ADDITION:       return walk(ast.left(), columns, row) + walk(ast.right(), columns, row);
+        case syntax::SUBTRACTION:    return walk(ast.left(), columns, row) - walk(ast.right(), columns, row);
+        case syntax::MULTIPLICATION: return walk(ast.left(), columns, row) * walk(ast.right(), columns, row);
+        case syntax::DIVITION:       return walk(ast.left(), columns, row) / walk(ast.right(), columns, row);
+        case syntax::LESS:           return walk(ast.left(), columns, row) < walk(ast.right(), columns, row);
+        case syntax::GREATER:        return walk(ast.left(), columns, row) > walk(ast.right(), columns, row);
+        case syntax::MINUS:          return -walk(ast.inner(), columns, row);
+        case syntax::IDENTIFIER:     return columns[ast.symbol][row];
+        case syntax::INT:            return double(ast.int_value);
+        case syntax::FLOAT:          return ast.float_value;
+        default:                     return 0;
+    }
+}
+
+void report_rows(const char* phase, const char* kind, size_t rows, measurement m) {
+    printf("%-18s %-12s %12.0f rows/s\n", phase, kind, rows / m.seconds);
+}
+
+// Evaluates expressions over x, y and z for a million rows of floats: row
+// by row with a tree walk and with the VM, and a column at a time.
+void benchmark_columns() {
+    const size_t rows = 1 << 20;
+    std::mt19937_64 random(1);
+    std::uniform_real_distribution<double> uniform(-100, 100);
+    std::vector<double> x(rows), y(rows), z(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        x[i] = uniform(random);
+        y[i] = uniform(random);
+        z[i] = uniform(random);
+    }
+
+    struct {
+        const char* kind;
+        const char* text;
+    } expressions[] = {
+        {"filter", "x * 2 + y > z"},
+        {"arithmetic", "(x - y) * (x + y) / 3 - z"},
+    };
+
+    for (auto& expression : expressions) {
+        // Declared first, so x, y and z take slots 0, 1 and 2.
+        compiler compile;
+        for (std::string declaration : {"x: float = 0.0", "y: float = 0.0", "z: float = 0.0"})
+            compile.compile(parser::from_string(declaration).parse());
+        std::string text = expression.text;
+        auto ast = parser::from_string(text, nullptr, &compile.symbols).parse();
+        auto code = compile.compile(ast);
+
+        std::vector<const double*> bound(compile.symbols.size());
+        bound[compile.symbols.find("x")] = x.data();
+        bound[compile.symbols.find("y")] = y.data();
+        bound[compile.symbols.find("z")] = z.data();
+
+        std::vector<double> results(rows);
+        auto tree_walk = measure([&] {
+            for (size_t i = 0; i < rows; ++i)
+                results[i] = walk(ast, bound, i);
+        });
+
+        vm machine;
+        machine.run(code);
+        auto row_vm = measure([&] {
+            for (size_t i = 0; i < rows; ++i) {
+                machine.slots[0].float_value = x[i];
+                machine.slots[1].float_value = y[i];
+                machine.slots[2].float_value = z[i];
+                results[i] = machine.run(code).float_value;
+            }
+        });
+
+        column_evaluator columns;
+        columns.bind("x", x.data());
+        columns.bind("y", y.data());
+        columns.bind("z", z.data());
+        columns.compile(ast);
+        auto column_at_a_time = measure([&] {
+            columns.run(rows);
+        });
+
+        report_rows("evaluate (walk)", expression.kind, rows, tree_walk);
+        report_rows("evaluate (vm)", expression.kind, rows, row_vm);
+        report_rows("evaluate (columns)", expression.kind, rows, column_at_a_time);
+    }
+}
+
+// Sends requests of a few hundred statements to a parse server in this
+// process from several clients at once: first one request at a time, to
+// time each round trip, then all of them pipelined.
+void benchmark_server(unsigned clients) {
+    const size_t requests = 2000;
+    auto source = corpus::find("sums")(16 << 10);
+    auto socket_path = "/tmp/benchmark-" + std::to_string(getpid()) + ".sock";
+
+    parse_server server;
+    server.listen(socket_path);
+    std::thread serving([&] { server.serve(); });
+
+    auto frame = std::string(sizeof(uint32_t), '\0') + source;
+    auto size = uint32_t(source.size());
+    std::memcpy(frame.data(), &size, sizeof size);
+    auto receive = [](int fd, std::string &body) {
+        parse_server::response_header header;
+        parse_server::read_all(fd, &header, sizeof header);
+        body.resize(header.size - (sizeof header - sizeof header.size));
+        parse_server::read_all(fd, body.data(), body.size());
+    };
+
+    using clock = std::chrono::steady_clock;
+    std::vector<std::vector<double>> latencies(clients);
+    auto start = clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned c = 0; c < clients; ++c)
+        threads.emplace_back([&, c] {
+            int fd = parse_server::connect(socket_path);
+            std::string body;
+            for (size_t i = 0; i < requests; ++i) {
+                auto sent = clock::now();
+                parse_server::write_all(fd, frame.data(), frame.size());
+                receive(fd, body);
+                latencies[c].push_back(std::chrono::duration<double>(clock::now() - sent).count());
+            }
+            ::close(fd);
+        });
+    for (auto& thread : threads)
+        thread.join();
+    auto one_at_a_time = std::chrono::duration<double>(clock::now() - start).count();
+
+    start = clock::now();
+    threads.clear();
+    for (unsigned c = 0; c < clients; ++c)
+        threads.emplace_back([&] {
+            int fd = parse_server::connect(socket_path);
+            std::thread sender([&] {
+                for (size_t i = 0; i < requests; ++i)
+                    parse_server::write_all(fd, frame.data(), frame.size());
+            });
+            std::string body;
+            for (size_t i = 0; i < requests; ++i)
+                receive(fd, body);
+            sender.join();
+            ::close(fd);
+        });
+    for (auto& thread : threads)
+        thread.join();
+    auto pipelined = std::chrono::duration<double>(clock::now() - start).count();
+
+    server.stop();
+    serving.join();
+
+    std::vector<double> all;
+    for (auto& client : latencies)
+        all.insert(all.end(), client.begin(), client.end());
+    std::sort(all.begin(), all.end());
+    auto total = double(clients * requests);
+    printf("serve (%u clients, %u workers, %zu byte requests)\n", clients, server.threads, source.size());
+    printf("%-18s %9.0f requests/s %9.1f us p50 %9.1f us p99\n", "one at a time",
+        total / one_at_a_time, all[all.size() / 2] * 1e6, all[all.size() * 99 / 100] * 1e6);
+    printf("%-18s %9.0f requests/s\n", "pipelined", total / pipelined);
+}
+
+int main(int argc, char** argv) {
+    // benchmark [size in MB] [corpus kinds...]
+    // benchmark --corpus <kind> <size in MB> writes a corpus to stdout.
+    // benchmark --server [clients] times a parse server over a socket.
+    if (argc == 4 && std::strcmp(argv[1], "--corpus") == 0) {
+        auto generate = corpus::find(argv[2]);
+        if (!generate) {
+            fprintf(stderr, "Unknown corpus '%s'.\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        auto text = generate(size_t(std::atof(argv[3]) * (1 << 20)));
+        fwrite(text.data(), 1, text.size(), stdout);
+        return EXIT_SUCCESS;
+    }
+    if (argc >= 2 && std::strcmp(argv[1], "--server") == 0) {
+        benchmark_server(argc > 2 ? unsigned(std::max(1, std::atoi(argv[2]))) : 4);
+        return EXIT_SUCCESS;
+    }
+
+    size_t size = size_t((argc > 1 ? std::atof(argv[1]) : 16) * (1 << 20));
+    std::cerr.rdbuf(nullptr);  // Error reports are still formatted, but not written.
+
+    printf("kernels: %s, corpus size: %zu bytes\n", char_scan::selected.name, size);
+    for (auto& kind : corpus::kinds()) {
+        bool selected = argc <= 2;
+        for (int i = 2; i < argc; ++i)
+            selected |= std::strcmp(argv[i], kind.name) == 0;
+        if (selected)
+            benchmark(kind.name, kind.generate(size));
+    }
+    benchmark_columns();
+    return EXIT_SUCCESS;
+}
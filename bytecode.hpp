@@ -0,0 +1,420 @@
+#pragma once
+#include "syntax.hpp"
+#include "symbols.hpp"
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// A compact bytecode for statements. Types are resolved by the compiler, so
+// the instructions are typed and work on untyped 8-byte values.
+struct bytecode {
+    enum type : uint8_t { NONE, INT, FLOAT, BOOL };
+
+    // Arithmetic and comparison opcodes follow the order of syntax::ENUM,
+    // from ADDITION and LESS respectively.
+    enum opcode : uint8_t {
+        PUSH,   // constants[operand]
+        LOAD,   // slots[operand]
+        STORE,  // slots[operand], leaving the value on the stack
+        TO_FLOAT,  // converts the int operand values below the top
+        ADD_INT, SUBTRACT_INT, MULTIPLY_INT, DIVIDE_INT,
+        ADD_FLOAT, SUBTRACT_FLOAT, MULTIPLY_FLOAT, DIVIDE_FLOAT,
+        LESS_INT, GREATER_INT, LESS_EQUAL_INT, GREATER_EQUAL_INT, NOT_EQUAL_INT, EQUAL_INT,
+        LESS_FLOAT, GREATER_FLOAT, LESS_EQUAL_FLOAT, GREATER_EQUAL_FLOAT, NOT_EQUAL_FLOAT, EQUAL_FLOAT,
+        NOT_EQUAL_BOOL, EQUAL_BOOL,
+        NEGATE_INT, NEGATE_FLOAT, NOT,
+    };
+
+    union value {
+        long   int_value;
+        double float_value;
+        bool   bool_value;
+    };
+
+    struct instruction {
+        opcode op;
+        uint32_t operand;
+    };
+
+    std::vector<instruction> code;
+    std::vector<value> constants;
+    type result = NONE;
+    uint32_t max_stack = 0;  // Deepest the stack gets while running the code
+    uint32_t slots = 0;      // Variable slots the code may touch
+};
+
+std::ostream& operator<<(std::ostream &str, bytecode::type type) {
+    switch (type) {
+        case bytecode::NONE:  str << "none"; break;
+        case bytecode::INT:   str << "int"; break;
+        case bytecode::FLOAT: str << "float"; break;
+        case bytecode::BOOL:  str << "bool"; break;
+    }
+    return str;
+}
+
+// Compiles statements to bytecode. Variables keep their slot and type from
+// one statement to the next, and are looked up by symbol. Identifiers parsed
+// with `symbols` are used as they are; others are interned here.
+struct compiler {
+    struct failure {
+        std::string message;
+    };
+
+    static constexpr uint32_t no_slot = UINT32_MAX;
+
+    struct variable {
+        uint32_t slot = no_slot;
+        bytecode::type type = bytecode::NONE;
+    };
+
+    symbol_table symbols;
+    std::vector<variable> variables;  // Indexed by symbol
+    uint32_t slots = 0;
+
+    // Walks the statement post-order with an explicit stack, so no tree the
+    // parser accepts is too deep to compile.
+    bytecode compile(const syntax& statement) {
+        bytecode code;
+        uint32_t depth = 0;
+        pending.clear();  // Left over if the last statement failed to compile.
+        types.clear();
+        pending.push_back({&statement, false});
+        while (!pending.empty()) {
+            auto& top = pending.back();
+            auto& ast = *top.node;
+            if (!top.expanded) {
+                top.expanded = true;  // Before expand() may move top.
+                if (expand(ast))
+                    continue;
+            }
+            pending.pop_back();
+            types.push_back(emit(code, ast, depth));
+        }
+        code.result = types.back();
+        code.slots = slots;
+        return code;
+    }
+
+private:
+    // A node still to be compiled, and whether its operands are pushed.
+    struct frame {
+        const syntax* node;
+        bool expanded;
+    };
+    std::vector<frame> pending;
+    std::vector<bytecode::type> types;  // Of the operands compiled so far
+    static failure fail(const std::string& message) {
+        return failure{message};
+    }
+
+    static bool numeric(bytecode::type type) {
+        return type == bytecode::INT || type == bytecode::FLOAT;
+    }
+
+    static void instruct(bytecode& code, bytecode::opcode op, uint32_t operand = 0) {
+        code.code.push_back({op, operand});
+    }
+
+    static void push(bytecode& code, bytecode::value value, uint32_t& depth) {
+        instruct(code, bytecode::PUSH, uint32_t(code.constants.size()));
+        code.constants.push_back(value);
+        if (++depth > code.max_stack)
+            code.max_stack = depth;
+    }
+
+    static std::string name(const syntax& id) {
+        return std::string(id.identifier());
+    }
+
+    variable& lookup(const syntax& id) {
+        auto symbol = id.symbol;
+        if (symbol == symbol_table::none)
+            symbol = symbols.intern(id.name, id.name_length);
+        if (symbol >= variables.size())
+            variables.resize(symbol + 1);
+        return variables[symbol];
+    }
+
+    variable& declared(const syntax& id) {
+        auto& var = lookup(id);
+        if (var.slot == no_slot)
+            throw fail("Undeclared variable '" + name(id) + "'.");
+        return var;
+    }
+
+    // Converts the value on top of the stack to the type of a variable.
+    static void convert(bytecode& code, bytecode::type from, bytecode::type to, const syntax& var) {
+        if (from == bytecode::INT && to == bytecode::FLOAT)
+            instruct(code, bytecode::TO_FLOAT, 0);
+        else if (from != to)
+            throw fail("Cannot store a value of type " + to_string(from) + " in '" + name(var) + "' of type " + to_string(to) + ".");
+    }
+
+    static std::string to_string(bytecode::type type) {
+        std::ostringstream str;
+        str << type;
+        return str.str();
+    }
+
+    // The declared type of a declaration, or NONE if it has none.
+    static bytecode::type declared_type(const syntax& ast) {
+        if (ast.type().is_none())
+            return bytecode::NONE;
+        auto type_name = name(ast.type());
+        if (type_name == "int")
+            return bytecode::INT;
+        if (type_name == "float")
+            return bytecode::FLOAT;
+        if (type_name == "bool")
+            return bytecode::BOOL;
+        throw fail("Unknown type '" + type_name + "'.");
+    }
+
+    bytecode::type operand() {
+        auto type = types.back();
+        types.pop_back();
+        return type;
+    }
+
+    // Pushes the operands to compile before the node, last first, and
+    // returns false if there are none. What can be checked before the
+    // operands is checked here, so errors come in the same order as from a
+    // recursive walk.
+    bool expand(const syntax& ast) {
+        switch (ast.kind) {
+            case syntax::PLUS:
+            case syntax::MINUS:
+            case syntax::NOT:
+                pending.push_back({&ast.inner(), false});
+                return true;
+            case syntax::ADDITION:
+            case syntax::SUBTRACTION:
+            case syntax::MULTIPLICATION:
+            case syntax::DIVITION:
+            case syntax::LESS:
+            case syntax::GREATER:
+            case syntax::LESS_EQUAL:
+            case syntax::GREATER_EQUAL:
+            case syntax::NOT_EQUAL:
+            case syntax::EQUAL:
+                pending.push_back({&ast.right(), false});
+                pending.push_back({&ast.left(), false});
+                return true;
+            case syntax::ASSIGNMENT:
+                declared(ast.left());
+                pending.push_back({&ast.right(), false});
+                return true;
+            case syntax::DECLARATION:
+                declared_type(ast);
+                if (ast.value().is_none())
+                    return false;
+                pending.push_back({&ast.value(), false});
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Emits a node whose operands are compiled, their types the last ones
+    // in types, and returns its type.
+    bytecode::type emit(bytecode& code, const syntax& ast, uint32_t& depth) {
+        switch (ast.kind) {
+            case syntax::INT: {
+                bytecode::value value;
+                value.int_value = ast.int_value;
+                push(code, value, depth);
+                return bytecode::INT;
+            }
+            case syntax::FLOAT: {
+                bytecode::value value;
+                value.float_value = ast.float_value;
+                push(code, value, depth);
+                return bytecode::FLOAT;
+            }
+            case syntax::BOOL: {
+                bytecode::value value;
+                value.bool_value = ast.bool_value;
+                push(code, value, depth);
+                return bytecode::BOOL;
+            }
+            case syntax::IDENTIFIER: {
+                auto& var = declared(ast);
+                instruct(code, bytecode::LOAD, var.slot);
+                if (++depth > code.max_stack)
+                    code.max_stack = depth;
+                return var.type;
+            }
+            case syntax::PLUS:
+            case syntax::MINUS: {
+                auto type = operand();
+                if (!numeric(type))
+                    throw fail("Unary '+' and '-' only apply to int and float values.");
+                if (ast.kind == syntax::MINUS)
+                    instruct(code, type == bytecode::INT ? bytecode::NEGATE_INT : bytecode::NEGATE_FLOAT);
+                return type;
+            }
+            case syntax::NOT: {
+                if (operand() != bytecode::BOOL)
+                    throw fail("'!' only applies to bool values.");
+                instruct(code, bytecode::NOT);
+                return bytecode::BOOL;
+            }
+            case syntax::ADDITION:
+            case syntax::SUBTRACTION:
+            case syntax::MULTIPLICATION:
+            case syntax::DIVITION:
+            case syntax::LESS:
+            case syntax::GREATER:
+            case syntax::LESS_EQUAL:
+            case syntax::GREATER_EQUAL:
+            case syntax::NOT_EQUAL:
+            case syntax::EQUAL: {
+                auto right = operand();
+                auto left = operand();
+                --depth;
+
+                bool arithmetic = ast.kind <= syntax::DIVITION;
+                bool equality = ast.kind == syntax::EQUAL || ast.kind == syntax::NOT_EQUAL;
+                if (left == bytecode::BOOL && right == bytecode::BOOL && equality) {
+                    instruct(code, ast.kind == syntax::EQUAL ? bytecode::EQUAL_BOOL : bytecode::NOT_EQUAL_BOOL);
+                    return bytecode::BOOL;
+                }
+                if (!numeric(left) || !numeric(right))
+                    throw fail(equality ?
+                        "'==' and '!=' only compare two numbers or two bools." :
+                        "Arithmetic and ordering only apply to int and float values.");
+
+                auto type = left == bytecode::INT && right == bytecode::INT ? bytecode::INT : bytecode::FLOAT;
+                if (left != type)
+                    instruct(code, bytecode::TO_FLOAT, 1);
+                if (right != type)
+                    instruct(code, bytecode::TO_FLOAT, 0);
+
+                int op = arithmetic ?
+                    (type == bytecode::INT ? bytecode::ADD_INT : bytecode::ADD_FLOAT) + (ast.kind - syntax::ADDITION) :
+                    (type == bytecode::INT ? bytecode::LESS_INT : bytecode::LESS_FLOAT) + (ast.kind - syntax::LESS);
+                instruct(code, bytecode::opcode(op));
+                return arithmetic ? type : bytecode::BOOL;
+            }
+            case syntax::ASSIGNMENT: {
+                auto var = declared(ast.left());
+                convert(code, operand(), var.type, ast.left());
+                instruct(code, bytecode::STORE, var.slot);
+                return var.type;
+            }
+            case syntax::DECLARATION: {
+                auto type = declared_type(ast);
+                if (!ast.value().is_none()) {
+                    auto value_type = operand();
+                    if (type == bytecode::NONE)
+                        type = value_type;
+                    convert(code, value_type, type, ast.var());
+                } else
+                    push(code, bytecode::value{0}, depth);  // Zero is 0, 0.0 and false.
+
+                auto& var = lookup(ast.var());
+                if (var.slot == no_slot)
+                    var.slot = slots++;
+                var.type = type;
+                instruct(code, bytecode::STORE, var.slot);
+                return type;
+            }
+            default:
+                throw fail("Cannot compile a statement that failed to parse.");
+        }
+    }
+};
+
+// Runs bytecode on a stack of untyped values. Variable slots persist between
+// runs, matching the compiler's variables.
+struct vm {
+    struct failure {
+        std::string message;
+    };
+
+    std::vector<bytecode::value> slots;
+    std::vector<bytecode::value> stack;
+
+    bytecode::value run(const bytecode& code) {
+        if (slots.size() < code.slots)
+            slots.resize(code.slots);
+        if (stack.size() < code.max_stack)
+            stack.resize(code.max_stack);
+
+        auto constants = code.constants.data();
+        auto variables = slots.data();
+        auto top = stack.data() - 1;
+
+        for (auto instruction : code.code) {
+            switch (instruction.op) {
+                case bytecode::PUSH:  *++top = constants[instruction.operand]; break;
+                case bytecode::LOAD:  *++top = variables[instruction.operand]; break;
+                case bytecode::STORE: variables[instruction.operand] = *top; break;
+                case bytecode::TO_FLOAT: {
+                    auto& value = top[-long(instruction.operand)];
+                    value.float_value = double(value.int_value);
+                    break;
+                }
+
+                #define BINARY(OP, RESULT, OPERAND, EXPR) \
+                    case bytecode::OP: { \
+                        auto right = top--->OPERAND; \
+                        auto left = top->OPERAND; \
+                        top->RESULT = EXPR; \
+                        break; \
+                    }
+                // Integers wrap around instead of overflowing.
+                BINARY(ADD_INT,             int_value,   int_value,   long(ulong(left) + ulong(right)))
+                BINARY(SUBTRACT_INT,        int_value,   int_value,   long(ulong(left) - ulong(right)))
+                BINARY(MULTIPLY_INT,        int_value,   int_value,   long(ulong(left) * ulong(right)))
+                BINARY(ADD_FLOAT,           float_value, float_value, left + right)
+                BINARY(SUBTRACT_FLOAT,      float_value, float_value, left - right)
+                BINARY(MULTIPLY_FLOAT,      float_value, float_value, left * right)
+                BINARY(DIVIDE_FLOAT,        float_value, float_value, left / right)
+                BINARY(LESS_INT,            bool_value,  int_value,   left < right)
+                BINARY(GREATER_INT,         bool_value,  int_value,   left > right)
+                BINARY(LESS_EQUAL_INT,      bool_value,  int_value,   left <= right)
+                BINARY(GREATER_EQUAL_INT,   bool_value,  int_value,   left >= right)
+                BINARY(NOT_EQUAL_INT,       bool_value,  int_value,   left != right)
+                BINARY(EQUAL_INT,           bool_value,  int_value,   left == right)
+                BINARY(LESS_FLOAT,          bool_value,  float_value, left < right)
+                BINARY(GREATER_FLOAT,       bool_value,  float_value, left > right)
+                BINARY(LESS_EQUAL_FLOAT,    bool_value,  float_value, left <= right)
+                BINARY(GREATER_EQUAL_FLOAT, bool_value,  float_value, left >= right)
+                BINARY(NOT_EQUAL_FLOAT,     bool_value,  float_value, left != right)
+                BINARY(EQUAL_FLOAT,         bool_value,  float_value, left == right)
+                BINARY(NOT_EQUAL_BOOL,      bool_value,  bool_value,  left != right)
+                BINARY(EQUAL_BOOL,          bool_value,  bool_value,  left == right)
+                #undef BINARY
+
+                case bytecode::DIVIDE_INT: {
+                    auto right = top--->int_value;
+                    if (right == 0)
+                        throw failure{"Division by zero."};
+                    if (right == -1)  // LONG_MIN / -1 overflows.
+                        top->int_value = long(0ul - ulong(top->int_value));
+                    else
+                        top->int_value /= right;
+                    break;
+                }
+                case bytecode::NEGATE_INT:   top->int_value = long(0ul - ulong(top->int_value)); break;
+                case bytecode::NEGATE_FLOAT: top->float_value = -top->float_value; break;
+                case bytecode::NOT:          top->bool_value = !top->bool_value; break;
+            }
+        }
+
+        return code.max_stack ? stack[0] : bytecode::value{0};
+    }
+};
+
+void print(std::ostream &str, bytecode::value value, bytecode::type type) {
+    switch (type) {
+        case bytecode::INT:   str << value.int_value << "i"; break;
+        case bytecode::FLOAT: str << value.float_value << "f"; break;
+        case bytecode::BOOL:  str << (value.bool_value ? "true" : "false"); break;
+        case bytecode::NONE:  str << "none"; break;
+    }
+}
@@ -0,0 +1,149 @@
+#pragma once
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHAR_SCAN_X86 1
+#endif
+
+// Finds the end of runs of blanks, identifier characters and digits. On x86
+// whole 16 or 32 byte blocks are classified at once, and the AVX2 kernels
+// are picked at startup when the CPU supports them. Other targets use the
+// scalar loops.
+struct char_scan {
+    enum ENUM { BLANK, IDENTIFIER, DIGIT };
+
+    using kernel = const char* (*)(const char* position, const char* end);
+
+    struct kernels {
+        const char* name;
+        kernel skip[3];
+    };
+
+    static const kernels selected;
+
+    template <ENUM kind>
+    static constexpr bool is(char c) {
+        if constexpr (kind == BLANK)
+            return c == ' ' || c == '\t' || c == '\r';
+        if constexpr (kind == DIGIT)
+            return (unsigned char)(c - '0') < 10;
+        return c == '_' ||
+            (unsigned char)(c - '0') < 10 ||
+            (unsigned char)((c | 0x20) - 'a') < 26;
+    }
+
+    // Returns the first position in [position, end) that is not of the kind.
+    template <ENUM kind>
+    static constexpr const char* skip(const char* position, const char* end) {
+        // Most runs are a single character, so don't pay for a call then.
+        if (position == end || !is<kind>(*position))
+            return position;
+        // The kernels are picked at run time, so constant expressions scan.
+        if (__builtin_is_constant_evaluated())
+            return skip_scalar<kind>(position + 1, end);
+        return selected.skip[kind](position + 1, end);
+    }
+
+    template <ENUM kind>
+    static constexpr const char* skip_scalar(const char* position, const char* end) {
+        while (position < end && is<kind>(*position))
+            ++position;
+        return position;
+    }
+
+#ifdef CHAR_SCAN_X86
+    // Signed compares only, so shift [low, high] down to start at -128.
+    static __m128i in_range(__m128i x, char low, char high) {
+        auto shifted = _mm_add_epi8(x, _mm_set1_epi8((char)(0x80 - low)));
+        return _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(0x80 + (high - low) + 1)));
+    }
+
+    template <ENUM kind>
+    static __m128i classify(__m128i x) {
+        if constexpr (kind == BLANK)
+            return _mm_or_si128(
+                _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                _mm_or_si128(
+                    _mm_cmpeq_epi8(x, _mm_set1_epi8('\t')),
+                    _mm_cmpeq_epi8(x, _mm_set1_epi8('\r'))
+                )
+            );
+        if constexpr (kind == DIGIT)
+            return in_range(x, '0', '9');
+        return _mm_or_si128(
+            _mm_or_si128(
+                in_range(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z'),
+                in_range(x, '0', '9')
+            ),
+            _mm_cmpeq_epi8(x, _mm_set1_epi8('_'))
+        );
+    }
+
+    template <ENUM kind>
+    static const char* skip_sse2(const char* position, const char* end) {
+        while (end - position >= 16) {
+            auto block = _mm_loadu_si128((const __m128i*)position);
+            unsigned misses = ~_mm_movemask_epi8(classify<kind>(block)) & 0xFFFF;
+            if (misses)
+                return position + __builtin_ctz(misses);
+            position += 16;
+        }
+        return skip_scalar<kind>(position, end);
+    }
+
+    __attribute__((target("avx2")))
+    static __m256i in_range(__m256i x, char low, char high) {
+        auto shifted = _mm256_add_epi8(x, _mm256_set1_epi8((char)(0x80 - low)));
+        return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + (high - low) + 1)), shifted);
+    }
+
+    template <ENUM kind>
+    __attribute__((target("avx2")))
+    static __m256i classify(__m256i x) {
+        if constexpr (kind == BLANK)
+            return _mm256_or_si256(
+                _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                _mm256_or_si256(
+                    _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t')),
+                    _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r'))
+                )
+            );
+        if constexpr (kind == DIGIT)
+            return in_range(x, '0', '9');
+        return _mm256_or_si256(
+            _mm256_or_si256(
+                in_range(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z'),
+                in_range(x, '0', '9')
+            ),
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_'))
+        );
+    }
+
+    template <ENUM kind>
+    __attribute__((target("avx2")))
+    static const char* skip_avx2(const char* position, const char* end) {
+        while (end - position >= 32) {
+            auto block = _mm256_loadu_si256((const __m256i*)position);
+            uint32_t misses = ~(uint32_t)_mm256_movemask_epi8(classify<kind>(block));
+            if (misses)
+                return position + __builtin_ctz(misses);
+            position += 32;
+        }
+        return skip_sse2<kind>(position, end);
+    }
+#endif
+
+    static kernels select() {
+#ifdef CHAR_SCAN_X86
+        __builtin_cpu_init();  // We may run before the CPU model is set up.
+        if (__builtin_cpu_supports("avx2"))
+            return {"avx2", {skip_avx2<BLANK>, skip_avx2<IDENTIFIER>, skip_avx2<DIGIT>}};
+        return {"sse2", {skip_sse2<BLANK>, skip_sse2<IDENTIFIER>, skip_sse2<DIGIT>}};
+#else
+        return {"scalar", {skip_scalar<BLANK>, skip_scalar<IDENTIFIER>, skip_scalar<DIGIT>}};
+#endif
+    }
+};
+
+const char_scan::kernels char_scan::selected = char_scan::select();
@@ -0,0 +1,76 @@
+#include "parse_server.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+int main(int argc, char** argv) {
+    // client <socket> [--batch <lines>]
+    // Sends the standard input to the server in requests of up to `lines`
+    // lines each, without waiting for responses in between, and prints
+    // each response as it comes: the statements to the standard output and
+    // the errors to the standard error.
+    if (argc < 2) {
+        std::cerr << "Usage: client <socket> [--batch <lines>]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    size_t batch = 1;
+    for (int i = 2; i < argc; ++i)
+        if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            batch = size_t(std::max(1, std::atoi(argv[++i])));
+
+    int fd;
+    try {
+        fd = parse_server::connect(argv[1]);
+    } catch(const std::system_error& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Requests are sent from their own thread, so responses are read while
+    // the server applies backpressure to the sender.
+    size_t errors = 0;
+    std::thread sender([&] {
+        try {
+            std::string request, line;
+            size_t lines = 0;
+            auto send = [&] {
+                auto size = uint32_t(request.size());
+                parse_server::write_all(fd, &size, sizeof size);
+                parse_server::write_all(fd, request.data(), request.size());
+                request.clear();
+                lines = 0;
+            };
+            while (std::getline(std::cin, line)) {
+                request += line;
+                request += '\n';
+                if (++lines == batch)
+                    send();
+            }
+            if (lines)
+                send();
+        } catch(const std::system_error& e) {
+            std::cerr << e.what() << std::endl;
+        }
+        ::shutdown(fd, SHUT_WR);  // No more requests.
+    });
+
+    try {
+        parse_server::response_header header;
+        while (parse_server::read_all(fd, &header, sizeof header)) {
+            std::string body(header.size - (sizeof header - sizeof header.size), '\0');
+            parse_server::read_all(fd, body.data(), body.size());
+            fwrite(body.data(), 1, header.syntax_size, stdout);
+            fwrite(body.data() + header.syntax_size, 1, body.size() - header.syntax_size, stderr);
+            errors += header.errors;
+        }
+    } catch(const std::system_error& e) {
+        std::cerr << e.what() << std::endl;
+    }
+    sender.join();
+    ::close(fd);
+    fflush(stdout);
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,617 @@
+#pragma once
+#include "bytecode.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLUMNAR_X86 1
+#endif
+
+// Evaluates one expression over many rows of variable values at once. Each
+// variable is bound to a column, an array with one value per row, and the
+// expression is compiled to a list of typed steps that each compute one
+// node for a whole batch of rows in a tight loop the compiler vectorizes.
+// Types and results follow the bytecode VM: integers wrap, ints are
+// converted to floats where mixed, and integer division by zero fails.
+//
+// Bool results also produce a selection vector: the rows where the
+// expression is true, e.g. the rows matching a filter such as x * 2 + y > z.
+struct column_evaluator {
+    struct failure {
+        std::string message;
+    };
+
+    // Rows are evaluated in batches small enough for every intermediate
+    // column of a batch to stay in cache.
+    static constexpr size_t batch_size = 1024;
+
+    // The result of run(): one column of the result type, and for bools the
+    // rows where it is true.
+    bytecode::type type = bytecode::NONE;
+    std::vector<long> ints;
+    std::vector<double> floats;
+    std::vector<uint8_t> bools;
+    std::vector<uint32_t> selection;
+
+    // Binds a variable to a column of values, which must hold a value for
+    // every row passed to run() and outlive it. Rebinding a variable to a
+    // column of another type needs a new compile().
+    void bind(const std::string &name, const long* values) { bind(name, bytecode::INT, values); }
+    void bind(const std::string &name, const double* values) { bind(name, bytecode::FLOAT, values); }
+    void bind(const std::string &name, const bool* values) { bind(name, bytecode::BOOL, values); }
+
+    // Throws failure if the expression does not type check, or uses a
+    // variable that is not bound. The expression is walked post-order with
+    // an explicit stack, so no tree the parser accepts is too deep.
+    void compile(const syntax &expression) {
+        type = bytecode::NONE;
+        steps.clear();
+        registers.clear();
+        for (auto& free : spare)
+            free.clear();
+        pending.clear();  // Left over if the last expression failed to compile.
+        operands.clear();
+        pending.push_back({&expression, false});
+        while (!pending.empty()) {
+            auto& top = pending.back();
+            auto& ast = *top.node;
+            if (!top.expanded) {
+                top.expanded = true;  // Before expand() may move top.
+                if (expand(ast))
+                    continue;
+            }
+            pending.pop_back();
+            operands.push_back(emit(ast));
+        }
+        result = operands.back();
+        type = result.type;
+        // The last step computes the root, straight into the result. A
+        // comparison there also appends to the selection as it compares.
+        compared = false;
+        if (result.source == operand::REGISTER) {
+            auto& root = steps.back();
+            root.target = into_result;
+            compared = comparison(root.op);
+            if (compared) {
+                // The root's operands are spare now, so fill new registers.
+                for (auto& free : spare)
+                    free.clear();
+                root.left = broadcast(root.left);
+                root.right = broadcast(root.right);
+            }
+        }
+    }
+
+    void run(size_t rows);
+
+private:
+    struct column {
+        std::string name;
+        bytecode::type type;
+        const void* data;
+    };
+    std::vector<column> columns;
+
+    // Where a step reads an operand from: an intermediate column, a bound
+    // column, or one value for every row.
+    struct operand {
+        enum SOURCE : uint8_t { REGISTER, INPUT, CONSTANT } source;
+        bytecode::type type;
+        uint32_t index;
+        bytecode::value constant;
+    };
+
+    static constexpr uint32_t into_result = UINT32_MAX;
+
+    struct step {
+        bytecode::opcode op;
+        operand left, right;
+        uint32_t target;  // A register, or into_result
+    };
+
+    struct register_t {
+        std::vector<long> ints;
+        std::vector<double> floats;
+        std::vector<uint8_t> bools;
+    };
+
+    // A node still to be compiled, and whether its operands are pushed.
+    struct frame {
+        const syntax* node;
+        bool expanded;
+    };
+
+    std::vector<step> steps;
+    std::vector<register_t> registers;
+    std::vector<uint32_t> spare[4];  // Free registers, by type
+    std::vector<frame> pending;
+    std::vector<operand> operands;  // Of the nodes compiled so far
+    operand result;
+    bool compared = false;  // The root is a comparison step
+    size_t selected = 0;    // Rows in the selection so far
+
+    static failure fail(const std::string &message) {
+        return failure{message};
+    }
+
+    static bool numeric(bytecode::type type) {
+        return type == bytecode::INT || type == bytecode::FLOAT;
+    }
+
+    void bind(const std::string &name, bytecode::type type, const void* data) {
+        for (auto& bound : columns)
+            if (bound.name == name) {
+                bound = {name, type, data};
+                return;
+            }
+        columns.push_back({name, type, data});
+    }
+
+    // Registers are reused once the step reading them is emitted, so a
+    // deep expression needs no more of them than a wide one.
+    operand allocate(bytecode::type type) {
+        if (!spare[type].empty()) {
+            auto index = spare[type].back();
+            spare[type].pop_back();
+            return {operand::REGISTER, type, index, {0}};
+        }
+        registers.emplace_back();
+        auto& storage = registers.back();
+        if (type == bytecode::INT)
+            storage.ints.resize(batch_size);
+        else if (type == bytecode::FLOAT)
+            storage.floats.resize(batch_size);
+        else
+            storage.bools.resize(batch_size);
+        return {operand::REGISTER, type, uint32_t(registers.size() - 1), {0}};
+    }
+
+    void release(const operand &value) {
+        if (value.source == operand::REGISTER)
+            spare[value.type].push_back(value.index);
+    }
+
+    // The output is allocated before the operands are released, so a step
+    // never writes a register it reads.
+    operand instruct(bytecode::opcode op, bytecode::type type, operand left, operand right = constant(bytecode::NONE, {0})) {
+        auto out = allocate(type);
+        steps.push_back({op, left, right, out.index});
+        release(left);
+        release(right);
+        return out;
+    }
+
+    operand to_float(operand value) {
+        if (value.source == operand::CONSTANT) {
+            value.constant.float_value = double(value.constant.int_value);
+            value.type = bytecode::FLOAT;
+            return value;
+        }
+        return instruct(bytecode::TO_FLOAT, bytecode::FLOAT, value);
+    }
+
+    // A register holding a constant for a whole batch, filled once here.
+    operand broadcast(operand value) {
+        if (value.source != operand::CONSTANT)
+            return value;
+        auto filled = allocate(value.type);
+        auto& storage = registers[filled.index];
+        std::fill(storage.ints.begin(), storage.ints.end(), value.constant.int_value);
+        std::fill(storage.floats.begin(), storage.floats.end(), value.constant.float_value);
+        std::fill(storage.bools.begin(), storage.bools.end(), value.constant.bool_value);
+        return filled;
+    }
+
+    static operand constant(bytecode::type type, bytecode::value value) {
+        return {operand::CONSTANT, type, 0, value};
+    }
+
+    static bool comparison(bytecode::opcode op) {
+        return op >= bytecode::LESS_INT && op <= bytecode::EQUAL_BOOL;
+    }
+
+    operand pop() {
+        auto popped = operands.back();
+        operands.pop_back();
+        return popped;
+    }
+
+    // Pushes the operands to compile before the node, last first, and
+    // returns false if there are none.
+    bool expand(const syntax &ast) {
+        switch (ast.kind) {
+            case syntax::PLUS:
+            case syntax::MINUS:
+            case syntax::NOT:
+                pending.push_back({&ast.inner(), false});
+                return true;
+            case syntax::ADDITION:
+            case syntax::SUBTRACTION:
+            case syntax::MULTIPLICATION:
+            case syntax::DIVITION:
+            case syntax::LESS:
+            case syntax::GREATER:
+            case syntax::LESS_EQUAL:
+            case syntax::GREATER_EQUAL:
+            case syntax::NOT_EQUAL:
+            case syntax::EQUAL:
+                pending.push_back({&ast.right(), false});
+                pending.push_back({&ast.left(), false});
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Emits the steps of a node whose operands are the last ones in
+    // operands, and returns where its values are.
+    operand emit(const syntax &ast) {
+        switch (ast.kind) {
+            case syntax::INT: {
+                bytecode::value value;
+                value.int_value = ast.int_value;
+                return constant(bytecode::INT, value);
+            }
+            case syntax::FLOAT: {
+                bytecode::value value;
+                value.float_value = ast.float_value;
+                return constant(bytecode::FLOAT, value);
+            }
+            case syntax::BOOL: {
+                bytecode::value value = {0};
+                value.bool_value = ast.bool_value;
+                return constant(bytecode::BOOL, value);
+            }
+            case syntax::IDENTIFIER: {
+                auto name = std::string(ast.identifier());
+                for (uint32_t i = 0; i < columns.size(); ++i)
+                    if (columns[i].name == name)
+                        return {operand::INPUT, columns[i].type, i, {0}};
+                throw fail("No column is bound to '" + name + "'.");
+            }
+            case syntax::PLUS:
+            case syntax::MINUS: {
+                auto inner = pop();
+                if (!numeric(inner.type))
+                    throw fail("Unary '+' and '-' only apply to int and float values.");
+                if (ast.kind == syntax::PLUS)
+                    return inner;
+                return instruct(inner.type == bytecode::INT ? bytecode::NEGATE_INT : bytecode::NEGATE_FLOAT, inner.type, inner);
+            }
+            case syntax::NOT: {
+                auto inner = pop();
+                if (inner.type != bytecode::BOOL)
+                    throw fail("'!' only applies to bool values.");
+                return instruct(bytecode::NOT, bytecode::BOOL, inner);
+            }
+            case syntax::ADDITION:
+            case syntax::SUBTRACTION:
+            case syntax::MULTIPLICATION:
+            case syntax::DIVITION:
+            case syntax::LESS:
+            case syntax::GREATER:
+            case syntax::LESS_EQUAL:
+            case syntax::GREATER_EQUAL:
+            case syntax::NOT_EQUAL:
+            case syntax::EQUAL: {
+                auto right = pop();
+                auto left = pop();
+
+                bool arithmetic = ast.kind <= syntax::DIVITION;
+                bool equality = ast.kind == syntax::EQUAL || ast.kind == syntax::NOT_EQUAL;
+                if (left.type == bytecode::BOOL && right.type == bytecode::BOOL && equality)
+                    return instruct(ast.kind == syntax::EQUAL ? bytecode::EQUAL_BOOL : bytecode::NOT_EQUAL_BOOL, bytecode::BOOL, left, right);
+                if (!numeric(left.type) || !numeric(right.type))
+                    throw fail(equality ?
+                        "'==' and '!=' only compare two numbers or two bools." :
+                        "Arithmetic and ordering only apply to int and float values.");
+
+                auto type = left.type == bytecode::INT && right.type == bytecode::INT ? bytecode::INT : bytecode::FLOAT;
+                if (left.type != type)
+                    left = to_float(left);
+                if (right.type != type)
+                    right = to_float(right);
+
+                int op = arithmetic ?
+                    (type == bytecode::INT ? bytecode::ADD_INT : bytecode::ADD_FLOAT) + (ast.kind - syntax::ADDITION) :
+                    (type == bytecode::INT ? bytecode::LESS_INT : bytecode::LESS_FLOAT) + (ast.kind - syntax::LESS);
+                return instruct(bytecode::opcode(op), arithmetic ? type : bytecode::BOOL, left, right);
+            }
+            default:
+                throw fail("Only expressions can be evaluated over columns.");
+        }
+    }
+
+    // The operand's values for the rows of the batch from start.
+    template <typename T>
+    const T* values(const operand &from, size_t start) {
+        if (from.source == operand::INPUT)
+            return (const T*)columns[from.index].data + start;
+        return output<T>(from.index);
+    }
+
+    template <typename T>
+    T* output(uint32_t index);
+
+    template <typename T>
+    T* results();
+
+    template <typename T>
+    T* destination(const step &s, size_t start) {
+        return s.target == into_result ? results<T>() + start : output<T>(s.target);
+    }
+
+    template <typename T>
+    static T scalar(const operand &from);
+
+    // The loops over a batch. Operands never overlap the output, and rows go
+    // in blocks of 16 whose inner loop counts from 0 to 16, so its trip count
+    // is known, it needs no remainder and vectorizes even under -O2's cheap
+    // cost model. The last rows of a batch shorter than a block run one at
+    // a time.
+    template <typename R, typename F>
+    static void each(R* __restrict out, size_t n, F f) {
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+            for (size_t j = 0; j < 16; ++j)
+                out[i + j] = R(f(i + j));
+        for (; i < n; ++i)
+            out[i] = R(f(i));
+    }
+
+    // out[i] = f(left[i], right[i]) for n rows, with constants kept out of
+    // the loop.
+    template <typename T, typename R, typename F>
+    void apply(const step &s, size_t start, size_t n, F f) {
+        auto out = destination<R>(s, start);
+        bool left_constant = s.left.source == operand::CONSTANT;
+        bool right_constant = s.right.source == operand::CONSTANT;
+        if (left_constant && right_constant) {
+            auto value = R(f(scalar<T>(s.left), scalar<T>(s.right)));
+            std::fill(out, out + n, value);
+        } else if (left_constant) {
+            auto left = scalar<T>(s.left);
+            const T* __restrict right = values<T>(s.right, start);
+            each(out, n, [&](size_t i) { return f(left, right[i]); });
+        } else if (right_constant) {
+            const T* __restrict left = values<T>(s.left, start);
+            auto right = scalar<T>(s.right);
+            each(out, n, [&](size_t i) { return f(left[i], right); });
+        } else {
+            const T* __restrict left = values<T>(s.left, start);
+            const T* __restrict right = values<T>(s.right, start);
+            each(out, n, [&](size_t i) { return f(left[i], right[i]); });
+        }
+    }
+
+    template <typename T, typename R, typename F>
+    void apply_unary(const step &s, size_t start, size_t n, F f) {
+        auto out = destination<R>(s, start);
+        if (s.left.source == operand::CONSTANT) {
+            std::fill(out, out + n, R(f(scalar<T>(s.left))));
+            return;
+        }
+        const T* __restrict in = values<T>(s.left, start);
+        each(out, n, [&](size_t i) { return f(in[i]); });
+    }
+
+    // For each mask of 4 rows: the positions of its set bits, followed by
+    // padding, how many there are, and the mask as 4 bools.
+    struct group_table {
+        uint32_t offsets[16][4];
+        uint32_t counts[16];
+        uint8_t bools[16][4];
+    };
+
+    static constexpr group_table make_groups() {
+        group_table table = {};
+        for (unsigned mask = 0; mask < 16; ++mask)
+            for (unsigned bit = 0; bit < 4; ++bit) {
+                table.bools[mask][bit] = (mask >> bit) & 1;
+                if (mask >> bit & 1)
+                    table.offsets[mask][table.counts[mask]++] = bit;
+            }
+        return table;
+    }
+
+    static const group_table groups;
+
+    // Writes the bools of the batch from start and appends the rows where
+    // they are true to the selection. Rows go in groups of 4, whose matches
+    // group(i) returns as a mask: all 4 offsets of the mask are written and
+    // only the matches kept, so no row branches. The selection has room for
+    // the 3 past its end. The last rows of a batch go one at a time.
+    template <typename G, typename F>
+    void select(size_t start, size_t n, G group, F test) {
+        auto out = bools.data() + start;
+        auto rows = selection.data();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            unsigned mask = group(i);
+            std::memcpy(out + i, groups.bools[mask], 4);
+            auto row = uint32_t(start + i);
+            for (size_t k = 0; k < 4; ++k)
+                rows[selected + k] = row + groups.offsets[mask][k];
+            selected += groups.counts[mask];
+        }
+        for (; i < n; ++i) {
+            out[i] = test(i);
+            rows[selected] = uint32_t(start + i);
+            selected += out[i];
+        }
+    }
+
+    // The root comparison, which selects as it compares rather than
+    // writing bools for store() to read again. Its operands are never
+    // constants, see compile(). On x86 floats are compared 2 at a time,
+    // as the compiler leaves scalar compares of doubles unvectorized: the
+    // same comparison of two __m128d gives a mask of each lane.
+    template <typename T, typename F>
+    void compare(const step &s, size_t start, size_t n, F f) {
+        const T* __restrict left = values<T>(s.left, start);
+        const T* __restrict right = values<T>(s.right, start);
+        auto test = [&](size_t i) { return f(left[i], right[i]); };
+#ifdef COLUMNAR_X86
+        if constexpr (std::is_same_v<T, double>) {
+            select(start, n, [&](size_t i) {
+                auto low = f(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i));
+                auto high = f(_mm_loadu_pd(left + i + 2), _mm_loadu_pd(right + i + 2));
+                return unsigned(_mm_movemask_pd((__m128d)low) | _mm_movemask_pd((__m128d)high) << 2);
+            }, test);
+            return;
+        }
+#endif
+        select(start, n, [&](size_t i) {
+            return unsigned(test(i)) | unsigned(test(i + 1)) << 1
+                | unsigned(test(i + 2)) << 2 | unsigned(test(i + 3)) << 3;
+        }, test);
+    }
+
+    void divide(const step &s, size_t start, size_t n);
+    void execute(const step &s, size_t start, size_t n);
+    void store(size_t start, size_t n);
+};
+
+constexpr column_evaluator::group_table column_evaluator::groups = column_evaluator::make_groups();
+
+template <>
+long* column_evaluator::output<long>(uint32_t index) { return registers[index].ints.data(); }
+template <>
+double* column_evaluator::output<double>(uint32_t index) { return registers[index].floats.data(); }
+template <>
+uint8_t* column_evaluator::output<uint8_t>(uint32_t index) { return registers[index].bools.data(); }
+
+template <>
+long* column_evaluator::results<long>() { return ints.data(); }
+template <>
+double* column_evaluator::results<double>() { return floats.data(); }
+template <>
+uint8_t* column_evaluator::results<uint8_t>() { return bools.data(); }
+
+template <>
+long column_evaluator::scalar<long>(const operand &from) { return from.constant.int_value; }
+template <>
+double column_evaluator::scalar<double>(const operand &from) { return from.constant.float_value; }
+template <>
+uint8_t column_evaluator::scalar<uint8_t>(const operand &from) { return from.constant.bool_value; }
+
+void column_evaluator::divide(const step &s, size_t start, size_t n) {
+    // Checked for zero in one pass first, so the division loop has no exits.
+    if (s.right.source == operand::CONSTANT) {
+        if (s.right.constant.int_value == 0)
+            throw failure{"Division by zero."};
+    } else {
+        auto right = values<long>(s.right, start);
+        bool zero = false;
+        for (size_t i = 0; i < n; ++i)
+            zero |= right[i] == 0;
+        if (zero)
+            throw failure{"Division by zero."};
+    }
+    // LONG_MIN / -1 overflows, so -1 negates instead, as in the VM.
+    apply<long, long>(s, start, n, [](long left, long right) {
+        return right == -1 ? long(0ul - ulong(left)) : left / right;
+    });
+}
+
+void column_evaluator::execute(const step &s, size_t start, size_t n) {
+    switch (s.op) {
+        #define BINARY(OP, R, T, EXPR) \
+            case bytecode::OP: \
+                apply<T, R>(s, start, n, [](T left, T right) { return EXPR; }); \
+                break;
+        #define COMPARE(OP, T, EXPR) \
+            case bytecode::OP: \
+                if (s.target == into_result) \
+                    compare<T>(s, start, n, [](auto left, auto right) { return EXPR; }); \
+                else \
+                    apply<T, uint8_t>(s, start, n, [](T left, T right) { return EXPR; }); \
+                break;
+        // Integers wrap around instead of overflowing.
+        BINARY(ADD_INT,             long,    long,    long(ulong(left) + ulong(right)))
+        BINARY(SUBTRACT_INT,        long,    long,    long(ulong(left) - ulong(right)))
+        BINARY(MULTIPLY_INT,        long,    long,    long(ulong(left) * ulong(right)))
+        BINARY(ADD_FLOAT,           double,  double,  left + right)
+        BINARY(SUBTRACT_FLOAT,      double,  double,  left - right)
+        BINARY(MULTIPLY_FLOAT,      double,  double,  left * right)
+        BINARY(DIVIDE_FLOAT,        double,  double,  left / right)
+        COMPARE(LESS_INT,            long,    left < right)
+        COMPARE(GREATER_INT,         long,    left > right)
+        COMPARE(LESS_EQUAL_INT,      long,    left <= right)
+        COMPARE(GREATER_EQUAL_INT,   long,    left >= right)
+        COMPARE(NOT_EQUAL_INT,       long,    left != right)
+        COMPARE(EQUAL_INT,           long,    left == right)
+        COMPARE(LESS_FLOAT,          double,  left < right)
+        COMPARE(GREATER_FLOAT,       double,  left > right)
+        COMPARE(LESS_EQUAL_FLOAT,    double,  left <= right)
+        COMPARE(GREATER_EQUAL_FLOAT, double,  left >= right)
+        COMPARE(NOT_EQUAL_FLOAT,     double,  left != right)
+        COMPARE(EQUAL_FLOAT,         double,  left == right)
+        COMPARE(NOT_EQUAL_BOOL,      uint8_t, left != right)
+        COMPARE(EQUAL_BOOL,          uint8_t, left == right)
+        #undef BINARY
+        #undef COMPARE
+
+        case bytecode::DIVIDE_INT:
+            divide(s, start, n); break;
+        case bytecode::TO_FLOAT:
+            apply_unary<long, double>(s, start, n, [](long value) { return double(value); }); break;
+        case bytecode::NEGATE_INT:
+            apply_unary<long, long>(s, start, n, [](long value) { return long(0ul - ulong(value)); }); break;
+        case bytecode::NEGATE_FLOAT:
+            apply_unary<double, double>(s, start, n, [](double value) { return -value; }); break;
+        case bytecode::NOT:
+            apply_unary<uint8_t, uint8_t>(s, start, n, [](uint8_t value) { return !value; }); break;
+        default:
+            break;
+    }
+}
+
+// Fills in the batch's result when the expression is a lone variable or
+// constant, and for bools appends the rows where it is true to the
+// selection without branching per row.
+void column_evaluator::store(size_t start, size_t n) {
+    auto copy = [&](auto* to) {
+        using T = std::remove_pointer_t<decltype(to)>;
+        if (result.source == operand::CONSTANT)
+            std::fill(to + start, to + start + n, scalar<T>(result));
+        else if (result.source == operand::INPUT)
+            std::memcpy(to + start, values<T>(result, start), n * sizeof(T));
+    };
+    if (type == bytecode::INT)
+        copy(ints.data());
+    else if (type == bytecode::FLOAT)
+        copy(floats.data());
+    else if (type == bytecode::BOOL && !compared) {
+        copy(bools.data());
+        auto matches = bools.data() + start;
+        auto rows = selection.data();
+        for (size_t i = 0; i < n; ++i) {
+            rows[selected] = uint32_t(start + i);
+            selected += matches[i];
+        }
+    }
+}
+
+void column_evaluator::run(size_t rows) {
+    // Only the result column of the type is kept, and it is overwritten in
+    // place rather than cleared.
+    ints.resize(type == bytecode::INT ? rows : 0);
+    floats.resize(type == bytecode::FLOAT ? rows : 0);
+    bools.resize(type == bytecode::BOOL ? rows : 0);
+    selection.resize(type == bytecode::BOOL ? rows + 3 : 0);
+    selected = 0;
+
+    for (size_t start = 0; start < rows; start += batch_size) {
+        auto n = std::min(batch_size, rows - start);
+        for (auto& s : steps)
+            execute(s, start, n);
+        store(start, n);
+    }
+    selection.resize(selected);
+}
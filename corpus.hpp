@@ -0,0 +1,130 @@
+#pragma once
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// Generates synthetic programs in the README grammar, for benchmarks and for
+// producing large test inputs. Every generator is deterministic and returns
+// whole statements totalling at least the requested number of bytes.
+struct corpus {
+    using generator = std::string (*)(size_t size);
+
+    struct kind {
+        const char* name;
+        generator generate;
+    };
+
+    static const std::vector<kind>& kinds() {
+        static const std::vector<kind> all = {
+            {"nesting", nesting},
+            {"sums", sums},
+            {"identifiers", identifiers},
+            {"numbers", numbers},
+            {"errors", errors},
+        };
+        return all;
+    }
+
+    static generator find(const std::string &name) {
+        for (auto& kind : kinds())
+            if (name == kind.name)
+                return kind.generate;
+        return nullptr;
+    }
+
+    // Deeply nested groups, e.g. ((((a + 1) * 2) - b) / 3).
+    static std::string nesting(size_t size) {
+        std::mt19937_64 random(1);
+        const char* operators[] = {" + ", " - ", " * ", " / "};
+        std::string text;
+        while (text.size() < size) {
+            int depth = 50 + random() % 150;
+            text.append(depth, '(');
+            text += "a";
+            for (int level = 0; level < depth; ++level) {
+                text += operators[random() % 4];
+                text += std::to_string(random() % 100);
+                text += ')';
+            }
+            text += '\n';
+        }
+        return text;
+    }
+
+    // Long flat sums, e.g. a + 1 - b + 2 - ...
+    static std::string sums(size_t size) {
+        std::mt19937_64 random(2);
+        std::string text;
+        while (text.size() < size) {
+            text += "total = x";
+            for (int term = 0; term < 1000; ++term) {
+                text += random() % 2 ? " + " : " - ";
+                text += random() % 2 ? "y" : std::to_string(random() % 1000);
+            }
+            text += '\n';
+        }
+        return text;
+    }
+
+    // Declarations and assignments of long identifiers.
+    static std::string identifiers(size_t size) {
+        std::mt19937_64 random(3);
+        const char* words[] = {
+            "total", "count", "index", "buffer", "offset", "length", "value",
+            "result", "cursor", "element", "window", "matrix", "vector_of"
+        };
+        auto name = [&] {
+            std::string id = words[random() % 13];
+            for (int part = random() % 3; part >= 0; --part)
+                id += std::string("_") + words[random() % 13];
+            return id;
+        };
+        std::string text;
+        while (text.size() < size) {
+            text += name();
+            text += random() % 2 ? ": int = " : " = ";
+            text += name() + " * " + name() + " + " + name() + " - " + name();
+            text += random() % 4 ? "\n" : "; ";
+        }
+        return text + '\n';
+    }
+
+    // Sums of INT and FLOAT literals of every shape the tokenizer accepts.
+    static std::string numbers(size_t size) {
+        std::mt19937_64 random(4);
+        std::string text;
+        char buffer[64];
+        while (text.size() < size) {
+            text += "x = ";
+            for (int term = 0; term < 8; ++term) {
+                switch (random() % 4) {
+                    case 0: snprintf(buffer, sizeof buffer, "%lu", random() % 1000000000); break;
+                    case 1: snprintf(buffer, sizeof buffer, "%lu.%lu", random() % 100000, random() % 100000000); break;
+                    case 2: snprintf(buffer, sizeof buffer, "%.17g", double(random() >> 11) * 1e-10); break;
+                    case 3: snprintf(buffer, sizeof buffer, "%lu.%lue-%lu", random() % 10, random() % 1000, random() % 300); break;
+                }
+                text += buffer;
+                text += term < 7 ? " + " : "\n";
+            }
+        }
+        return text;
+    }
+
+    // Mostly malformed statements, to measure error reporting and recovery.
+    static std::string errors(size_t size) {
+        std::mt19937_64 random(5);
+        const char* statements[] = {
+            "a = (b + c\n",
+            "x: \n",
+            "total = 1 + * 2\n",
+            "value = -(-3) $ 4\n",
+            "y = 1 2 3\n",
+            "z = a + b * c\n",
+        };
+        std::string text;
+        while (text.size() < size)
+            text += statements[random() % 6];
+        return text;
+    }
+};
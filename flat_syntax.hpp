@@ -0,0 +1,314 @@
+#pragma once
+#include "parser.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// A flat alternative to `syntax`: node kinds, operands and literal payloads
+// live in parallel arrays addressed by 32-bit node ids. Nodes are appended in
+// post-order, so every operand has a lower id than the node using it, and a
+// forward scan over the arrays visits the tree bottom-up.
+struct flat_syntax {
+    using id = uint32_t;
+    static constexpr id no_node = UINT32_MAX;
+
+    union payload {
+        long   int_value;
+        double float_value;
+        bool   bool_value;
+        struct { uint32_t offset, length; } name;  // IDENTIFIER, into source
+        id     type;                               // DECLARATION
+    };
+
+    const char* source = nullptr;
+    std::vector<uint8_t> kinds;
+    // Operands: unaries use left for the inner node, and declarations use
+    // left for the variable and right for the value. Absent nodes are no_node.
+    // Identifiers keep their symbol in left.
+    std::vector<id> left, right;
+    std::vector<payload> values;
+    id root = no_node;
+
+    // The flat syntax nodes are appended to on this thread.
+    static thread_local flat_syntax* active;
+
+    struct scope {
+        flat_syntax* previous;
+        scope(flat_syntax* nodes) : previous(active) { active = nodes; }
+        ~scope() { active = previous; }
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+    };
+
+    struct node;
+
+    flat_syntax(const char* source = nullptr) : source(source) {}
+
+    static flat_syntax from_string(const std::string &str);
+
+    size_t size() const { return kinds.size(); }
+    syntax::ENUM kind(id n) const { return (syntax::ENUM)kinds[n]; }
+    id inner(id n) const { return left[n]; }
+    id var(id n) const { return left[n]; }
+    id type(id n) const { return values[n].type; }
+    id value(id n) const { return right[n]; }
+    uint32_t symbol(id n) const { return left[n]; }
+    std::string_view name(id n) const {
+        return std::string_view(source + values[n].name.offset, values[n].name.length);
+    }
+
+    id append(syntax::ENUM kind, id left, id right, payload value) {
+        parser_stats::node(kind);
+        kinds.push_back(kind);
+        this->left.push_back(left);
+        this->right.push_back(right);
+        values.push_back(value);
+        return id(kinds.size() - 1);
+    }
+
+    void clear() {
+        kinds.clear();
+        left.clear();
+        right.clear();
+        values.clear();
+        root = no_node;
+    }
+
+    syntax to_syntax(id n) const;
+    syntax to_syntax() const { return to_syntax(root); }
+
+    // Converts nodes first through last of any post-order flat layout with
+    // the accessors above into converted[i - first], in one forward scan;
+    // operands are always converted before the nodes that use them.
+    template <typename flat>
+    static void convert(const flat &ast, id first, id last, std::vector<syntax> &converted);
+};
+
+thread_local flat_syntax* flat_syntax::active = nullptr;
+
+// A handle to a node in the active flat_syntax. It mirrors the constructors
+// of `syntax`, so basic_parser can build either representation.
+struct flat_syntax::node {
+    using allocator = flat_syntax;
+
+    syntax::ENUM kind = syntax::NONE;
+    id index = no_node;
+
+    node(syntax::ENUM kind, node&& inner) : kind(kind) {
+        assert(active);
+        index = active->append(kind, inner.index, no_node, payload{0});
+    }
+    node(syntax::ENUM kind, node&& left, node&& right) : kind(kind) {
+        assert(active);
+        index = active->append(kind, left.index, right.index, payload{0});
+    }
+    node(node&& var, node&& type, node&& value) : kind(syntax::DECLARATION) {
+        assert(active);
+        payload declared;
+        declared.type = type.index;
+        index = active->append(kind, var.index, value.index, declared);
+    }
+    node(const char* position, int length, uint32_t symbol = symbol_table::none) : kind(syntax::IDENTIFIER) {
+        assert(active && active->source && position >= active->source);
+        payload name;
+        name.name = {uint32_t(position - active->source), uint32_t(length)};
+        index = active->append(kind, symbol, no_node, name);
+    }
+    node(long value) : kind(syntax::INT) {
+        assert(active);
+        payload literal;
+        literal.int_value = value;
+        index = active->append(kind, no_node, no_node, literal);
+    }
+    node(double value) : kind(syntax::FLOAT) {
+        assert(active);
+        payload literal;
+        literal.float_value = value;
+        index = active->append(kind, no_node, no_node, literal);
+    }
+    node(bool value) : kind(syntax::BOOL) {
+        assert(active);
+        payload literal;
+        literal.bool_value = value;
+        index = active->append(kind, no_node, no_node, literal);
+    }
+    node() {}  // NONE same as none()
+
+    static node fail() {
+        auto fail = node();
+        fail.kind = syntax::FAILED;
+        return fail;
+    }
+    static node none() { return node(); }
+
+    bool is_none() const { return kind == syntax::NONE; }
+    bool failed() const { return kind == syntax::FAILED; }
+};
+
+using flat_parser = basic_parser<flat_syntax::node>;
+
+flat_syntax flat_syntax::from_string(const std::string &str) {
+    auto tree = std::make_shared<flat_syntax>(str.data());
+    auto root = flat_parser::from_string(str, tree).parse();
+    if (root.is_none())
+        tree->clear();  // Drop whatever was built before the failure.
+    tree->root = root.index;
+    return std::move(*tree);
+}
+
+// Converts the subtree at n to the pointer representation. In post-order
+// the subtree is the nodes from its lowest id through n, so only those are
+// converted.
+syntax flat_syntax::to_syntax(id n) const {
+    if (n == no_node)
+        return syntax::none();
+
+    id first = n;
+    std::vector<id> pending = {n};
+    while (!pending.empty()) {
+        auto i = pending.back();
+        pending.pop_back();
+        first = std::min(first, i);
+        switch (kind(i)) {
+            case syntax::DECLARATION:
+                for (auto operand : {var(i), type(i), value(i)})
+                    if (operand != no_node)
+                        pending.push_back(operand);
+                break;
+            case syntax::ADDITION:
+            case syntax::SUBTRACTION:
+            case syntax::MULTIPLICATION:
+            case syntax::DIVITION:
+            case syntax::NOT_EQUAL:
+            case syntax::EQUAL:
+            case syntax::LESS:
+            case syntax::GREATER:
+            case syntax::LESS_EQUAL:
+            case syntax::GREATER_EQUAL:
+            case syntax::ASSIGNMENT:
+                pending.push_back(left[i]);
+                pending.push_back(right[i]);
+                break;
+            case syntax::PLUS:
+            case syntax::MINUS:
+            case syntax::NOT:
+                pending.push_back(inner(i));
+                break;
+            default:
+                break;
+        }
+    }
+
+    std::vector<syntax> converted(n - first + 1);
+    convert(*this, first, n, converted);
+    return std::move(converted.back());
+}
+
+template <typename flat>
+void flat_syntax::convert(const flat &ast, id first, id last, std::vector<syntax> &converted) {
+    auto take = [&](id operand) { return operand == no_node ? syntax::none() : std::move(converted[operand - first]); };
+    for (id i = first; i <= last; ++i) {
+        auto& node = converted[i - first];
+        switch (ast.kind(i)) {
+            case syntax::DECLARATION:
+                node = syntax(take(ast.var(i)), take(ast.type(i)), take(ast.value(i))); break;
+            case syntax::ADDITION:
+            case syntax::SUBTRACTION:
+            case syntax::MULTIPLICATION:
+            case syntax::DIVITION:
+            case syntax::NOT_EQUAL:
+            case syntax::EQUAL:
+            case syntax::LESS:
+            case syntax::GREATER:
+            case syntax::LESS_EQUAL:
+            case syntax::GREATER_EQUAL:
+            case syntax::ASSIGNMENT:
+                node = syntax(ast.kind(i), take(ast.left[i]), take(ast.right[i])); break;
+            case syntax::PLUS:
+            case syntax::MINUS:
+            case syntax::NOT:
+                node = syntax(ast.kind(i), take(ast.inner(i))); break;
+            case syntax::IDENTIFIER:
+                node = syntax(ast.name(i).data(), int(ast.name(i).size()), ast.symbol(i)); break;
+            case syntax::INT:
+                node = syntax(ast.values[i].int_value); break;
+            case syntax::FLOAT:
+                node = syntax(ast.values[i].float_value); break;
+            case syntax::BOOL:
+                node = syntax(ast.values[i].bool_value); break;
+            default:
+                break;
+        }
+    }
+}
+
+// Prints node n of any flat layout, e.g. flat_syntax or syntax_image. Like
+// syntax_printer it keeps what is left to print on a stack, operands and
+// text pushed in reverse, so no tree is too deep to print.
+template <typename flat>
+void print(std::ostream &str, const flat &ast, flat_syntax::id n) {
+    struct step {
+        flat_syntax::id node;
+        const char* text;  // Printed instead of a node when set.
+    };
+    std::vector<step> pending = {{n, nullptr}};
+    auto then = [&](flat_syntax::id node) { pending.push_back({node, nullptr}); };
+    auto then_text = [&](const char* text) { pending.push_back({flat_syntax::no_node, text}); };
+
+    while (!pending.empty()) {
+        auto next = pending.back();
+        pending.pop_back();
+        if (next.text) {
+            str << next.text;
+            continue;
+        }
+        n = next.node;
+        if (n == flat_syntax::no_node) {
+            str << "none";
+            continue;
+        }
+        const char* op = nullptr;
+        switch (ast.kind(n)) {
+            case syntax::DECLARATION:
+                str << "(";
+                then_text(")"); then(ast.value(n)); then_text(" = "); then(ast.type(n)); then_text(": ");
+                then(ast.var(n));
+                continue;
+            case syntax::ADDITION:       op = " + "; break;
+            case syntax::SUBTRACTION:    op = " - "; break;
+            case syntax::MULTIPLICATION: op = " * "; break;
+            case syntax::DIVITION:       op = " / "; break;
+            case syntax::NOT_EQUAL:      op = " != "; break;
+            case syntax::EQUAL:          op = " == "; break;
+            case syntax::LESS:           op = " < "; break;
+            case syntax::GREATER:        op = " > "; break;
+            case syntax::LESS_EQUAL:     op = " <= "; break;
+            case syntax::GREATER_EQUAL:  op = " >= "; break;
+            case syntax::ASSIGNMENT:     op = " = "; break;
+            case syntax::PLUS:
+                str << "(+ "; then_text(")"); then(ast.inner(n)); continue;
+            case syntax::MINUS:
+                str << "(- "; then_text(")"); then(ast.inner(n)); continue;
+            case syntax::NOT:
+                str << "(! "; then_text(")"); then(ast.inner(n)); continue;
+            case syntax::IDENTIFIER:
+                str << "'" << ast.name(n) << "'id"; continue;
+            case syntax::INT:
+                str << ast.values[n].int_value << "i"; continue;
+            case syntax::FLOAT:
+                str << ast.values[n].float_value << "f"; continue;
+            case syntax::BOOL:
+                str << (ast.values[n].bool_value ? "true" : "false"); continue;
+            default:
+                str << "failed"; continue;
+        }
+        str << "(";
+        then_text(")"); then(ast.right[n]); then_text(op); then(ast.left[n]);
+    }
+}
+
+std::ostream& operator<<(std::ostream &str, const flat_syntax& ast) {
+    print(str, ast, ast.root);
+    return str;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// A fast, non-cryptographic 64-bit hash of a byte string. The bytes are
+// mixed in 8 at a time, so it suits short names and whole sources alike.
+inline uint64_t hash_bytes(const char* data, size_t length) {
+    auto mix = [](uint64_t hashed, uint64_t word) {
+        hashed = (hashed ^ word) * 0xff51afd7ed558ccdull;
+        return hashed ^ (hashed >> 32);
+    };
+    uint64_t hashed = length * 0x9e3779b97f4a7c15ull;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hashed = mix(hashed, word);
+    }
+    if (i < length) {
+        uint64_t word = 0;
+        std::memcpy(&word, data + i, length - i);
+        hashed = mix(hashed, word);
+    }
+    return hashed ^ (hashed >> 29);
+}
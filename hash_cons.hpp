@@ -0,0 +1,261 @@
+#pragma once
+#include "syntax.hpp"
+#include "hash.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Interns syntax trees so that structurally identical subtrees become one
+// shared node, turning many statements into a single DAG. Interned nodes
+// live in the table's arena, are never modified and outlive every handle to
+// them, so two interned subtrees are equal exactly when same() holds, which
+// compares their kind and a pointer. Results computed per node can likewise
+// be cached by identity().
+//
+// Leaves carry their value in the handle and need no node of their own.
+// Identifiers point to one copy of each name, kept with the symbol of the
+// first one seen, so they too are the same exactly when their names are.
+struct hash_cons {
+    size_t seen = 0;        // Interior nodes interned, counting every repeat
+    size_t unique = 0;      // Interior nodes allocated
+    size_t tree_bytes = 0;  // What the seen nodes take as separate trees
+
+    hash_cons() : buckets(1024) {}
+    hash_cons(const hash_cons&) = delete;
+    hash_cons& operator=(const hash_cons&) = delete;
+
+    // Returns the interned copy of a tree, which is left untouched. Trees
+    // of any depth are interned without recursion.
+    syntax intern(const syntax &tree);
+
+    // What identifies an interned node: its value for leaves, otherwise
+    // the address of its shared node.
+    static uint64_t identity(const syntax &ast) {
+        switch (ast.kind) {
+            case syntax::INT: return uint64_t(ast.int_value);
+            case syntax::FLOAT: {
+                uint64_t bits;
+                std::memcpy(&bits, &ast.float_value, sizeof bits);
+                return bits;
+            }
+            case syntax::BOOL: return ast.bool_value;
+            case syntax::NONE:
+            case syntax::FAILED: return 0;
+            case syntax::DECLARATION: return uint64_t(ast.declaration);
+            case syntax::PLUS:
+            case syntax::MINUS:
+            case syntax::NOT: return uint64_t(ast.unary);
+            case syntax::IDENTIFIER: return uint64_t(ast.name);
+            default: return uint64_t(ast.binary);
+        }
+    }
+
+    static bool same(const syntax &a, const syntax &b) {
+        return a.kind == b.kind && identity(a) == identity(b);
+    }
+
+    // The shared nodes and names, to compare with tree_bytes.
+    size_t bytes() const { return storage.bytes_used(); }
+
+    // The table that finds the shared nodes, only needed while interning.
+    size_t table_bytes() const { return buckets.capacity() * sizeof(bucket); }
+
+private:
+    struct bucket {
+        uint32_t hash = 0;  // The low bits, enough to place it in any table
+        uint32_t kind = syntax::NONE;  // NONE when empty
+        void* node = nullptr;
+    };
+    std::vector<bucket> buckets;  // Open addressing, at most half full
+    size_t entries = 0;
+    arena storage;
+
+    // A copy of a name, whose characters follow it.
+    struct shared_name {
+        uint32_t length, symbol;
+        const char* text() const { return (const char*)(this + 1); }
+    };
+
+    struct frame {
+        const syntax* node;
+        bool expanded;
+    };
+    std::vector<frame> pending;
+    std::vector<syntax> done;  // Interned subtrees waiting for their parent
+
+    static syntax handle(syntax::ENUM kind, void* node) {
+        syntax shared;
+        shared.kind = kind;
+        shared.pooled = true;
+        if (kind == syntax::DECLARATION)
+            shared.declaration = (syntax::declaration_t*)node;
+        else if (kind == syntax::IDENTIFIER) {
+            auto name = (const shared_name*)node;
+            shared.name = name->text();
+            shared.name_length = uint16_t(name->length);
+            shared.symbol = name->symbol;
+        } else if (kind >= syntax::PLUS)
+            shared.unary = (syntax::unary_t*)node;
+        else
+            shared.binary = (syntax::binary_t*)node;
+        return shared;
+    }
+
+    static syntax copy(const syntax &leaf) {
+        syntax value;
+        value.kind = leaf.kind;
+        if (leaf.kind == syntax::INT)
+            value.int_value = leaf.int_value;
+        else if (leaf.kind == syntax::FLOAT)
+            value.float_value = leaf.float_value;
+        else if (leaf.kind == syntax::BOOL)
+            value.bool_value = leaf.bool_value;
+        return value;
+    }
+
+    // Buckets are picked by the low bits, so the high bits are folded into
+    // them; node addresses alone differ little in their low bits.
+    static uint64_t mix(uint64_t hash, uint64_t value) {
+        auto mixed = (hash ^ value) * 0x9E3779B97F4A7C15ull;
+        return mixed ^ (mixed >> 29);
+    }
+
+    static bool equal(const bucket &b, syntax::ENUM kind, const syntax* children);
+    static bool equal(const bucket &b, const syntax &id);
+
+    // Finds the bucket holding a node equal to the one described, or the
+    // empty bucket it belongs in.
+    template <typename F>
+    bucket& find(uint64_t hash, syntax::ENUM kind, F matches) {
+        auto mask = buckets.size() - 1;
+        for (auto i = hash & mask;; i = (i + 1) & mask) {
+            auto& b = buckets[i];
+            if (b.kind == syntax::NONE || (b.hash == uint32_t(hash) && b.kind == kind && matches(b)))
+                return b;
+        }
+    }
+
+    void insert(bucket &b, uint64_t hash, syntax::ENUM kind, void* node) {
+        b = {uint32_t(hash), uint32_t(kind), node};
+        if (++entries * 2 > buckets.size())
+            rehash();
+    }
+
+    void rehash() {
+        std::vector<bucket> grown(buckets.size() * 2);
+        auto mask = grown.size() - 1;
+        for (auto& b : buckets) {
+            if (b.kind == syntax::NONE)
+                continue;
+            auto i = b.hash & mask;
+            while (grown[i].kind != syntax::NONE)
+                i = (i + 1) & mask;
+            grown[i] = b;
+        }
+        buckets = std::move(grown);
+    }
+
+    syntax identifier(const syntax &ast);
+    syntax compound(syntax::ENUM kind);
+};
+
+bool hash_cons::equal(const bucket &b, syntax::ENUM kind, const syntax* children) {
+    switch (kind) {
+        case syntax::DECLARATION: {
+            auto node = (const syntax::declaration_t*)b.node;
+            return same(node->var, children[0]) && same(node->type, children[1]) && same(node->value, children[2]);
+        }
+        case syntax::PLUS:
+        case syntax::MINUS:
+        case syntax::NOT:
+            return same(((const syntax::unary_t*)b.node)->inner, children[0]);
+        default: {
+            auto node = (const syntax::binary_t*)b.node;
+            return same(node->left, children[0]) && same(node->right, children[1]);
+        }
+    }
+}
+
+bool hash_cons::equal(const bucket &b, const syntax &id) {
+    auto name = (const shared_name*)b.node;
+    return name->length == id.name_length && std::memcmp(name->text(), id.name, id.name_length) == 0;
+}
+
+syntax hash_cons::identifier(const syntax &ast) {
+    auto hash = mix(hash_bytes(ast.name, ast.name_length), syntax::IDENTIFIER);
+    auto& b = find(hash, syntax::IDENTIFIER, [&](const bucket &candidate) { return equal(candidate, ast); });
+    void* node = b.node;  // insert() may grow the table and move b.
+    if (b.kind == syntax::NONE) {
+        // The name is copied, so the DAG outlives the source it came from.
+        auto name = (shared_name*)storage.allocate(sizeof(shared_name) + ast.name_length, alignof(shared_name));
+        *name = {ast.name_length, ast.symbol};
+        std::memcpy(name + 1, ast.name, ast.name_length);
+        node = name;
+        insert(b, hash, syntax::IDENTIFIER, node);
+    }
+    return handle(syntax::IDENTIFIER, node);
+}
+
+// Interns a node whose interned children are the last ones in done,
+// replacing them with the node.
+syntax hash_cons::compound(syntax::ENUM kind) {
+    size_t count = kind == syntax::DECLARATION ? 3 : kind >= syntax::PLUS ? 1 : 2;
+    auto children = done.data() + done.size() - count;
+
+    auto hash = uint64_t(kind);
+    for (size_t i = 0; i < count; ++i)
+        hash = mix(hash, identity(children[i]) ^ (uint64_t(children[i].kind) << 56));
+    auto& b = find(hash, kind, [&](const bucket &candidate) { return equal(candidate, kind, children); });
+    void* node = b.node;
+    if (b.kind == syntax::NONE) {
+        if (kind == syntax::DECLARATION)
+            node = storage.make<syntax::declaration_t>(std::move(children[0]), std::move(children[1]), std::move(children[2]));
+        else if (count == 1)
+            node = storage.make<syntax::unary_t>(std::move(children[0]));
+        else
+            node = storage.make<syntax::binary_t>(std::move(children[0]), std::move(children[1]));
+        insert(b, hash, kind, node);
+        ++unique;
+    }
+    done.resize(done.size() - count);
+    return handle(kind, node);
+}
+
+syntax hash_cons::intern(const syntax &tree) {
+    pending.push_back({&tree, false});
+    while (!pending.empty()) {
+        auto& top = pending.back();
+        auto& ast = *top.node;
+        if (ast.has_children() && !top.expanded) {
+            // Children are pushed last first, so they are interned in order.
+            top.expanded = true;
+            if (ast.kind == syntax::DECLARATION) {
+                pending.push_back({&ast.value(), false});
+                pending.push_back({&ast.type(), false});
+                pending.push_back({&ast.var(), false});
+            } else if (ast.kind >= syntax::PLUS) {
+                pending.push_back({&ast.inner(), false});
+            } else {
+                pending.push_back({&ast.right(), false});
+                pending.push_back({&ast.left(), false});
+            }
+            continue;
+        }
+        pending.pop_back();
+
+        if (ast.has_children()) {
+            ++seen;
+            tree_bytes += ast.kind == syntax::DECLARATION ? sizeof(syntax::declaration_t) :
+                ast.kind >= syntax::PLUS ? sizeof(syntax::unary_t) : sizeof(syntax::binary_t);
+            auto node = compound(ast.kind);
+            done.push_back(std::move(node));
+        } else if (ast.kind == syntax::IDENTIFIER)
+            done.push_back(identifier(ast));
+        else
+            done.push_back(copy(ast));
+    }
+    auto interned = std::move(done.back());
+    done.pop_back();
+    return interned;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "token.hpp"
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A source file mapped read-only into memory. Scanners, tokens and syntax
+// built from it point straight into the mapping, so it must outlive them.
+struct mapped_file {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    static mapped_file open(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), path);
+
+        struct stat info;
+        if (fstat(fd, &info) < 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), path);
+        }
+
+        mapped_file file;
+        file.size = info.st_size;
+        if (file.size == 0) {
+            ::close(fd);
+            file.data = "";  // mmap() refuses empty mappings.
+            return file;
+        }
+
+        void* mapping = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        int error = errno;
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+            throw std::system_error(error, std::generic_category(), path);
+        madvise(mapping, file.size, MADV_SEQUENTIAL);
+
+        file.data = (const char*)mapping;
+        return file;
+    }
+
+    mapped_file() {}
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    mapped_file(mapped_file&& other) { *this = std::move(other); }
+    mapped_file& operator=(mapped_file&& other) {
+        std::swap(data, other.data);
+        std::swap(size, other.size);
+        return *this;
+    }
+    ~mapped_file() {
+        if (size)
+            munmap((void*)data, size);
+    }
+
+    const char* begin() const { return data; }
+    const char* end() const { return data + size; }
+
+    string_scanner scanner() const {
+        return string_scanner::from_range(begin(), end());
+    }
+};
@@ -0,0 +1,104 @@
+#pragma once
+#include "parser.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Parses a large input on several threads. The input is cut into chunks at
+// statement ends, each worker parses chunks with its own tokenizer and arena,
+// and the statements are put back together in source order.
+//
+// Any ";" or "\n" is a safe place to cut: no expression consumes one, so a
+// statement never spans it, and a failed statement is skipped up to it. The
+// result is therefore the same as parse_program on the whole input, groups
+// with unbalanced parentheses included. Errors are collected per chunk and
+// reported after the workers finish, in source order.
+struct parallel_parser {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t chunk_size = 1 << 20;
+    bool iterative = false;
+    unsigned max_depth = 1000;
+
+    struct program {
+        std::vector<std::shared_ptr<arena>> arenas;  // One per worker
+        std::vector<syntax> statements;
+    };
+
+    using chunk = std::pair<const char*, const char*>;
+
+    std::vector<chunk> split(const char* begin, const char* end) const {
+        std::vector<chunk> chunks;
+        while (begin < end) {
+            auto cut = end - begin > ptrdiff_t(chunk_size) ? begin + chunk_size : end;
+            while (cut < end && cut[-1] != '\n' && cut[-1] != ';')
+                ++cut;
+            chunks.push_back({begin, cut});
+            begin = cut;
+        }
+        return chunks;
+    }
+
+    program parse(const char* begin, const char* end) const {
+        auto chunks = split(begin, end);
+        std::vector<std::vector<syntax>> parsed(chunks.size());
+        std::vector<std::vector<parser::failure>> failures(chunks.size());
+        std::vector<std::exception_ptr> errors(threads);
+        std::atomic<size_t> next_chunk{0};
+
+        program result;
+        for (unsigned i = 0; i < threads; ++i)
+            result.arenas.push_back(std::make_shared<arena>());
+
+        auto work = [&](unsigned worker) {
+            try {
+                for (size_t i; (i = next_chunk++) < chunks.size();) {
+                    auto [chunk_begin, chunk_end] = chunks[i];
+                    auto parser = parser::from_range(chunk_begin, chunk_end, result.arenas[worker]);
+                    parser.iterative = iterative;
+                    parser.max_depth = max_depth;
+                    // Errors are reported after the join, in source order, and
+                    // name the token before the cut as they would without it.
+                    parser.diagnostics = &failures[i];
+                    if (chunk_begin != begin)
+                        parser.previous_token = token(chunk_begin, chunk_begin[-1]);
+                    parsed[i] = parser.parse_program();
+                    for (auto& statement : parsed[i])
+                        if (statement.failed())
+                            statement = syntax::none();
+                }
+            } catch(...) {
+                errors[worker] = std::current_exception();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < threads; ++i)
+            workers.emplace_back(work, i);
+        work(0);
+        for (auto& worker : workers)
+            worker.join();
+
+        for (auto& error : errors)
+            if (error)
+                std::rethrow_exception(error);
+
+        for (auto& chunk : failures)
+            for (auto& failure : chunk)
+                std::cerr << parser::describe(failure, begin, end);
+
+        size_t total = 0;
+        for (auto& statements : parsed)
+            total += statements.size();
+        result.statements.reserve(total);
+        for (auto& statements : parsed)
+            for (auto& statement : statements)
+                result.statements.push_back(std::move(statement));
+
+        return result;
+    }
+};
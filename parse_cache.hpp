@@ -0,0 +1,107 @@
+#pragma once
+#include "parser.hpp"
+#include "hash.hpp"
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Remembers the syntax of recently parsed statements by the hash of their
+// text, so a statement seen before costs a hash and a lookup. Entries are
+// shared and immutable: each owns a copy of its text and an arena for its
+// nodes, and stays alive for as long as anyone holds it, even once evicted.
+// The least recently used entries are evicted to stay within a byte budget.
+//
+// Cached syntax is only valid for the parser settings it was parsed with,
+// so one cache should be used with one symbol table and simplifier.
+struct parse_cache {
+    struct entry {
+        std::string text;
+        uint64_t hash = 0;
+        std::shared_ptr<arena> nodes;
+        syntax statement;        // none if the statement failed
+        std::string diagnostic;  // The failure, as reported by the parser
+        size_t bytes = 0;
+
+        bool failed() const { return !diagnostic.empty(); }
+    };
+
+    using result = std::shared_ptr<const entry>;
+
+    size_t budget;
+    size_t bytes = 0;
+    size_t hits = 0, misses = 0, evictions = 0;
+
+    symbol_table* symbols = nullptr;
+    simplifier* simplify = nullptr;
+    bool iterative = false;
+    unsigned max_depth = 1000;
+
+    parse_cache(size_t budget = 16 << 20) : budget(budget) {}
+
+    result parse(const std::string &text) {
+        auto hashed = hash_bytes(text.data(), text.size());
+        auto found = index.find(hashed);
+        if (found != index.end() && (*found->second)->text == text) {
+            ++hits;
+            recent.splice(recent.begin(), recent, found->second);
+            return *found->second;
+        }
+
+        ++misses;
+        auto parsed = std::make_shared<entry>();
+        parsed->text = text;
+        parsed->hash = hashed;
+        parsed->nodes = std::make_shared<arena>(small_block_size);
+
+        std::vector<parser::failure> diagnostics;
+        auto parser = parser::from_string(parsed->text, parsed->nodes, symbols);
+        parser.simplify = simplify;
+        parser.iterative = iterative;
+        parser.max_depth = max_depth;
+        parser.diagnostics = &diagnostics;
+        parsed->statement = parser.parse();
+        if (!diagnostics.empty())
+            parsed->diagnostic = parser.describe(diagnostics.front());
+        parsed->bytes = sizeof(entry) + parsed->text.size() + parsed->diagnostic.size() + parsed->nodes->bytes_reserved();
+
+        if (found != index.end())
+            erase(found);  // A different text with the same hash.
+        recent.push_front(parsed);
+        index.emplace(hashed, recent.begin());
+        bytes += parsed->bytes;
+        while (bytes > budget && recent.size() > 1)
+            evict();
+        return parsed;
+    }
+
+    size_t size() const { return recent.size(); }
+
+    void clear() {
+        index.clear();
+        recent.clear();
+        bytes = 0;
+    }
+
+private:
+    // Most statements are small, so their arenas start small too.
+    static constexpr size_t small_block_size = 512;
+
+    using list = std::list<std::shared_ptr<entry>>;
+    list recent;  // Most recently used first
+    std::unordered_map<uint64_t, list::iterator> index;
+
+    void erase(std::unordered_map<uint64_t, list::iterator>::iterator found) {
+        bytes -= (*found->second)->bytes;
+        recent.erase(found->second);
+        index.erase(found);
+    }
+
+    void evict() {
+        auto& oldest = recent.back();
+        erase(index.find(oldest->hash));
+        ++evictions;
+    }
+};
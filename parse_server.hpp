@@ -0,0 +1,394 @@
+#pragma once
+#include "parser.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Parses batches of statements sent over a Unix domain socket, so a client
+// can keep one server process instead of starting the REPL per request.
+//
+// Every message is a frame: a 32-bit size in native byte order followed by
+// that many bytes. A request is the source of one batch of statements. Its
+// response continues the header with the counts of statements and errors
+// and the size of the printed statements, one per line with failed ones
+// printed as none as by --program, which come next, followed by a
+// description of every error.
+//
+// Requests are parsed on a fixed pool of workers, each reusing its own
+// arena, printer and diagnostics. A client may pipeline requests without
+// waiting for responses, which come back in request order. Backpressure
+// keeps memory bounded: a connection stops being read while it has
+// pipeline_limit requests in flight, or while queue_limit requests from all
+// connections wait for a worker, and the client then blocks in write().
+// Each connection takes a reader and a writer thread, so connections past
+// max_connections are closed as soon as they are accepted.
+struct parse_server {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t queue_limit = 1024;
+    size_t pipeline_limit = 64;
+    size_t max_connections = 256;
+    uint32_t max_request = 64 << 20;  // Larger requests close the connection
+    syntax_printer::FORMAT format = syntax_printer::TEXT;
+    bool iterative = false;
+    unsigned max_depth = 1000;
+
+    struct response_header {
+        uint32_t size;  // Of the rest of the frame
+        uint32_t statements;
+        uint32_t errors;
+        uint32_t syntax_size;
+    };
+
+    parse_server() {}
+    parse_server(const parse_server&) = delete;
+    parse_server& operator=(const parse_server&) = delete;
+    ~parse_server() { stop(); }
+
+    // Listens on a socket at path, replacing any socket file there, and
+    // starts the workers. Throws std::system_error.
+    void listen(const std::string &path);
+
+    // Accepts connections until stop() is called.
+    void serve();
+
+    // Stops accepting, closes every connection and joins all threads.
+    void stop();
+
+    // Connects a client to the server listening at path. Throws
+    // std::system_error.
+    static int connect(const std::string &path);
+
+    // Reads or writes exactly size bytes, retrying short transfers. read_all
+    // returns false at the end of the input, and both throw std::system_error.
+    static bool read_all(int fd, void* data, size_t size);
+    static void write_all(int fd, const void* data, size_t size);
+
+private:
+    struct connection {
+        int fd;
+        std::mutex lock;
+        std::condition_variable changed;
+        uint64_t requests = 0;      // Sequence number of the next request read
+        uint64_t responses = 0;     // Sequence number of the next response written
+        std::map<uint64_t, std::string> ready;  // Responses waiting for earlier ones
+        bool reading = true;    // Until the reader returns
+        bool closed = false;    // Set when a write fails or the server stops
+        bool finished = false;  // Set when the writer has closed fd
+        std::thread reader, writer;
+    };
+
+    struct job {
+        std::shared_ptr<connection> from;
+        uint64_t sequence;
+        std::string source;
+    };
+
+    // What a worker keeps from one request to the next.
+    struct worker_state {
+        std::shared_ptr<arena> nodes = std::make_shared<arena>();
+        syntax_printer printer;
+        std::vector<parser::failure> diagnostics;
+        std::string errors;
+    };
+
+    int listener = -1;
+    std::string path;
+    bool stopping = false;
+
+    std::mutex lock;
+    std::condition_variable queued, dequeued;
+    std::deque<job> queue;
+    std::vector<std::thread> workers;
+    std::vector<std::shared_ptr<connection>> connections;
+
+    void work();
+    std::string respond(worker_state &state, const std::string &source);
+    void read_requests(std::shared_ptr<connection> client);
+    void write_responses(std::shared_ptr<connection> client);
+};
+
+static sockaddr_un socket_address(const std::string &path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof address.sun_path)
+        throw std::system_error(ENAMETOOLONG, std::generic_category(), path);
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+int parse_server::connect(const std::string &path) {
+    auto address = socket_address(path);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "socket");
+    if (::connect(fd, (const sockaddr*)&address, sizeof address) < 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), path);
+    }
+    return fd;
+}
+
+bool parse_server::read_all(int fd, void* data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        auto result = ::read(fd, (char*)data + done, size - done);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result < 0)
+            throw std::system_error(errno, std::generic_category(), "read");
+        if (result == 0) {
+            if (done == 0)
+                return false;
+            throw std::system_error(EPIPE, std::generic_category(), "read");
+        }
+        done += size_t(result);
+    }
+    return true;
+}
+
+void parse_server::write_all(int fd, const void* data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        // A client that went away fails the write instead of raising SIGPIPE.
+        auto result = ::send(fd, (const char*)data + done, size - done, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result < 0)
+            throw std::system_error(errno, std::generic_category(), "write");
+        done += size_t(result);
+    }
+}
+
+void parse_server::listen(const std::string &socket_path) {
+    auto address = socket_address(socket_path);
+    listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        throw std::system_error(errno, std::generic_category(), "socket");
+    ::unlink(socket_path.c_str());
+    if (::bind(listener, (const sockaddr*)&address, sizeof address) < 0 || ::listen(listener, 128) < 0) {
+        int error = errno;
+        ::close(listener);
+        listener = -1;
+        throw std::system_error(error, std::generic_category(), socket_path);
+    }
+    path = socket_path;
+
+    for (unsigned i = 0; i < threads; ++i)
+        workers.emplace_back([this] { work(); });
+}
+
+void parse_server::serve() {
+    for (;;) {
+        int fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0 && errno == EINTR)
+            continue;
+        if (fd < 0)
+            return;  // The listener was shut down by stop().
+
+        std::vector<std::shared_ptr<connection>> finished;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (stopping) {
+                ::close(fd);
+                return;
+            }
+            auto open = std::partition(connections.begin(), connections.end(), [](auto &client) {
+                std::lock_guard<std::mutex> client_guard(client->lock);
+                return !client->finished;
+            });
+            finished.assign(open, connections.end());
+            connections.erase(open, connections.end());
+
+            if (connections.size() < max_connections) {
+                auto client = std::make_shared<connection>();
+                client->fd = fd;
+                client->reader = std::thread([this, client] { read_requests(client); });
+                client->writer = std::thread([this, client] { write_responses(client); });
+                connections.push_back(client);
+            } else {
+                ::close(fd);  // Refused, so the client reads the end of the input.
+            }
+        }
+        // Joined without the lock, which their last steps may still need.
+        for (auto& client : finished) {
+            client->reader.join();
+            client->writer.join();
+        }
+    }
+}
+
+void parse_server::stop() {
+    std::vector<std::shared_ptr<connection>> open;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (listener < 0)
+            return;
+        stopping = true;
+        open.swap(connections);
+    }
+    queued.notify_all();
+    dequeued.notify_all();
+    ::shutdown(listener, SHUT_RDWR);
+
+    for (auto& client : open) {
+        {
+            std::lock_guard<std::mutex> guard(client->lock);
+            if (!client->finished)
+                ::shutdown(client->fd, SHUT_RDWR);
+            client->closed = true;
+        }
+        client->changed.notify_all();
+        client->reader.join();
+        client->writer.join();
+    }
+    for (auto& worker : workers)
+        worker.join();
+    workers.clear();
+
+    ::close(listener);
+    listener = -1;
+    ::unlink(path.c_str());
+}
+
+void parse_server::read_requests(std::shared_ptr<connection> client) {
+    try {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> guard(client->lock);
+                client->changed.wait(guard, [&] {
+                    return client->closed || client->requests - client->responses < pipeline_limit;
+                });
+                if (client->closed)
+                    break;
+            }
+
+            uint32_t size;
+            if (!read_all(client->fd, &size, sizeof size) || size > max_request)
+                break;
+            std::string source(size, '\0');
+            if (!read_all(client->fd, source.data(), size))
+                break;
+
+            std::unique_lock<std::mutex> guard(lock);
+            dequeued.wait(guard, [&] { return stopping || queue.size() < queue_limit; });
+            if (stopping)
+                break;
+            std::unique_lock<std::mutex> client_guard(client->lock);
+            queue.push_back({client, client->requests++, std::move(source)});
+            queued.notify_one();
+        }
+    } catch(const std::system_error&) {
+        // A broken connection is closed like a finished one.
+    }
+
+    std::lock_guard<std::mutex> guard(client->lock);
+    client->reading = false;
+    client->changed.notify_all();
+}
+
+void parse_server::write_responses(std::shared_ptr<connection> client) {
+    std::unique_lock<std::mutex> guard(client->lock);
+    for (;;) {
+        // Done once the reader has returned and every request it read has
+        // been answered, or dropped if the connection closed.
+        client->changed.wait(guard, [&] {
+            return (!client->closed && client->ready.count(client->responses)) ||
+                (!client->reading && (client->closed || client->responses == client->requests));
+        });
+        auto next = client->ready.find(client->responses);
+        if (client->closed || next == client->ready.end())
+            break;
+
+        auto response = std::move(next->second);
+        client->ready.erase(next);
+        guard.unlock();
+        bool written = true;
+        try {
+            write_all(client->fd, response.data(), response.size());
+        } catch(const std::system_error&) {
+            written = false;
+        }
+        guard.lock();
+        ++client->responses;
+        if (!written) {
+            client->closed = true;
+            ::shutdown(client->fd, SHUT_RDWR);  // Wakes the reader.
+        }
+        client->changed.notify_all();
+    }
+    ::close(client->fd);
+    client->finished = true;
+}
+
+void parse_server::work() {
+    worker_state state;
+    state.printer.format = format;
+    for (;;) {
+        job next;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            queued.wait(guard, [&] { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+            next = std::move(queue.front());
+            queue.pop_front();
+            dequeued.notify_one();
+        }
+
+        auto response = respond(state, next.source);
+        {
+            std::lock_guard<std::mutex> guard(next.from->lock);
+            next.from->ready.emplace(next.sequence, std::move(response));
+        }
+        next.from->changed.notify_all();
+    }
+}
+
+std::string parse_server::respond(worker_state &state, const std::string &source) {
+    state.nodes->reset();
+    state.diagnostics.clear();
+    state.printer.buffer.clear();
+    state.errors.clear();
+
+    auto parser = parser::from_string(source, state.nodes);
+    parser.iterative = iterative;
+    parser.max_depth = max_depth;
+    parser.diagnostics = &state.diagnostics;
+    auto statements = parser.parse_program();
+    // Failed statements print as none, as they do with --program.
+    for (auto& statement : statements) {
+        if (statement.failed())
+            statement = syntax::none();
+        state.printer.line(statement);
+    }
+    for (auto& failure : state.diagnostics)
+        state.errors += parser.describe(failure);
+
+    response_header header;
+    header.size = uint32_t(sizeof header - sizeof header.size + state.printer.buffer.size() + state.errors.size());
+    header.statements = uint32_t(statements.size());
+    header.errors = uint32_t(state.diagnostics.size());
+    header.syntax_size = uint32_t(state.printer.buffer.size());
+
+    std::string response;
+    response.reserve(sizeof header + header.size);
+    response.append((const char*)&header, sizeof header);
+    response += state.printer.buffer;
+    response += state.errors;
+    return response;
+}
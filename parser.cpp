@@ -1,28 +1,335 @@
 #include "parser.hpp"
+#include "flat_syntax.hpp"
+#include "mapped_file.hpp"
+#include "parallel_parser.hpp"
+#include "bytecode.hpp"
+#include "syntax_image.hpp"
+#include "parse_cache.hpp"
+#include "printer.hpp"
+#include "stream_parser.hpp"
+#include "parse_server.hpp"
 #include <iostream>
+#include <cstring>
+#include <iterator>
+
+int main(int argc, char** argv) {
+    // --arena: allocate every statement in one reusable arena.
+    // --flat: parse into the flat, index-based syntax instead.
+    // --program: parse all of the standard input as one program.
+    // --stream: parse the standard input in chunks as it arrives.
+    // --serve <socket>: parse requests from a Unix socket on --threads workers.
+    // --file <path>: map the file into memory and parse it as one program.
+    // --threads <n>: parse a program on n threads.
+    // --iterative: parse expressions with a heap stack instead of recursion.
+    // --max-depth <n>: the deepest nesting of groups accepted.
+    // --format <text|sexpr|json>: how a program's syntax is printed.
+    // --memo <MB>: reuse the syntax of lines seen before, within MB megabytes.
+    // --tokens: tokenize a program up front into a token buffer, then parse it.
+    // --check: report every error in a program, and only the errors.
+    // --cache <path>: load a program from a syntax image saved from the same
+    //     source with the same options, or parse it and save the image.
+    // --run: compile each line to bytecode and run it.
+    // --simplify: fold constants and apply identities while parsing.
+    // --share: share identical subtrees of a program's statements.
+    std::shared_ptr<arena> nodes;
+    bool flat = false, program = false, run = false, simplify = false, buffered = false, check = false, stream = false;
+    const char* path = nullptr, *cache = nullptr, *socket = nullptr;
+    unsigned threads = 0;
+    std::unique_ptr<parse_cache> memo;
+    auto format = syntax_printer::TEXT;
+    bool iterative = false, limited = false;
+    unsigned max_depth = 1000;
+    std::unique_ptr<hash_cons> shared;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--arena") == 0)
+            nodes = std::make_shared<arena>();
+        else if (std::strcmp(argv[i], "--flat") == 0)
+            flat = true;
+        else if (std::strcmp(argv[i], "--program") == 0)
+            program = true;
+        else if (std::strcmp(argv[i], "--stream") == 0)
+            stream = true;
+        else if (std::strcmp(argv[i], "--run") == 0)
+            run = true;
+        else if (std::strcmp(argv[i], "--simplify") == 0)
+            simplify = true;
+        else if (std::strcmp(argv[i], "--share") == 0)
+            shared = std::make_unique<hash_cons>();
+        else if (std::strcmp(argv[i], "--tokens") == 0)
+            buffered = true;
+        else if (std::strcmp(argv[i], "--check") == 0)
+            check = true;
+        else if (std::strcmp(argv[i], "--file") == 0 && i + 1 < argc)
+            path = argv[++i];
+        else if (std::strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            cache = argv[++i];
+        else if (std::strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            socket = argv[++i];
+        else if (std::strcmp(argv[i], "--iterative") == 0)
+            iterative = true;
+        else if (std::strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) {
+            max_depth = unsigned(std::max(0, std::atoi(argv[++i])));
+            limited = true;
+        } else if (std::strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (!syntax_printer::parse_format(argv[++i], format)) {
+                std::cerr << "Unknown format '" << argv[i] << "', expected text, sexpr or json." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--memo") == 0 && i + 1 < argc)
+            memo = std::make_unique<parse_cache>(size_t(std::atof(argv[++i]) * (1 << 20)));
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = std::max(1, std::atoi(argv[++i]));
+    }
+
+    // Subtrees are only shared by the parsers of a whole program on one thread.
+    if (shared && (!(program || path) || stream || socket || threads || check || memo)) {
+        std::cerr << "--share only applies to --program and --file, without --stream, --serve, --threads, --check or --memo." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // The flat syntax is only printed by the REPL, parsed with the defaults.
+    if (flat && (nodes || program || path || stream || socket || threads || buffered || check || cache ||
+                 run || simplify || shared || memo || iterative || limited || format != syntax_printer::TEXT)) {
+        std::cerr << "--flat only applies to the REPL, without any other flag." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (socket) {
+        parse_server server;
+        if (threads)
+            server.threads = threads;
+        server.format = format;
+        server.iterative = iterative;
+        server.max_depth = max_depth;
+        try {
+            server.listen(socket);
+        } catch(const std::system_error& e) {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cerr << "Serving on " << socket << " with " << server.threads << " workers." << std::endl;
+        server.serve();
+        return EXIT_SUCCESS;
+    }
+
+    if (stream) {
+        compiler compiler;
+        vm machine;
+        simplifier simplified;
+        syntax_printer output(STDOUT_FILENO, format);
+        stream_parser streamed;
+        streamed.symbols = &compiler.symbols;
+        streamed.simplify = simplify ? &simplified : nullptr;
+        streamed.iterative = iterative;
+        streamed.max_depth = max_depth;
+        try {
+            streamed.parse(STDIN_FILENO, [&](syntax &statement) {
+                if (!run) {
+                    output.line(statement);
+                    return;
+                }
+                if (statement.is_none())
+                    return;
+                try {
+                    auto code = compiler.compile(statement);
+                    print(std::cout, machine.run(code), code.result);
+                    std::cout << '\n';
+                } catch(const compiler::failure& f) {
+                    std::cerr << "\033[1;31m" << f.message << "\033[0m" << std::endl;
+                } catch(const vm::failure& f) {
+                    std::cerr << "\033[1;31m" << f.message << "\033[0m" << std::endl;
+                }
+            });
+        } catch(const std::system_error& e) {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        output.flush();
+        std::cout << std::flush;
+        return EXIT_SUCCESS;
+    }
+
+    if (program || path) {
+        mapped_file file;
+        std::string source;
+        if (path) {
+            try {
+                file = mapped_file::open(path);
+            } catch(const std::system_error& e) {
+                std::cerr << e.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else
+            source.assign(std::istreambuf_iterator<char>(std::cin), {});
+
+        auto begin = path ? file.begin() : source.data();
+        auto end = path ? file.end() : source.data() + source.size();
+        // An image holds only the syntax, and these modes print more than
+        // that or parse differently.
+        if (cache && (check || threads || buffered || shared)) {
+            std::cerr << "--cache is not used with --check, --threads, --tokens or --share." << std::endl;
+            cache = nullptr;
+        }
+        syntax_image::options parsed;
+        parsed.simplified = simplify;
+        parsed.max_depth = max_depth;
+        if (cache) {
+            try {
+                auto image = syntax_image::open(cache);
+                if (image.matches(begin, end, parsed) && format == syntax_printer::TEXT) {
+                    for (size_t i = 0; i < image.statements(); ++i) {
+                        print(std::cout, image, image.statement(i));
+                        std::cout << '\n';
+                    }
+                    std::cout << std::flush;
+                    return EXIT_SUCCESS;
+                } else if (image.matches(begin, end, parsed)) {
+                    syntax_printer output(STDOUT_FILENO, format);
+                    for (auto& statement : image.to_syntax())
+                        output.line(statement);
+                    output.flush();
+                    return EXIT_SUCCESS;
+                }
+            } catch(const std::exception&) {
+                // Missing or invalid, so parse and save it again below.
+            }
+        }
+
+        syntax_printer output(STDOUT_FILENO, format);
+        if (check) {
+            std::vector<parser::failure> diagnostics;
+            auto parser = parser::from_range(begin, end, nodes);
+            parser.iterative = iterative;
+            parser.max_depth = max_depth;
+            parser.diagnostics = &diagnostics;
+            auto statements = parser.parse_program().size();
+            for (auto& failure : diagnostics)
+                std::cerr << parser.describe(failure);
+            std::cerr << diagnostics.size() << " errors in " << statements << " statements." << std::endl;
+            return diagnostics.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+        } else if (threads) {
+            auto parallel = parallel_parser();
+            parallel.threads = threads;
+            parallel.iterative = iterative;
+            parallel.max_depth = max_depth;
+            for (auto& statement : parallel.parse(begin, end).statements)
+                output.line(statement);
+        } else if (buffered) {
+            auto tokens = token_buffer::from_range(begin, end);
+            simplifier simplified;
+            auto parser = buffered_parser::from_tokens(token_buffer::cursor(tokens), nodes);
+            parser.iterative = iterative;
+            parser.max_depth = max_depth;
+            parser.simplify = simplify ? &simplified : nullptr;
+            parser.shared = shared.get();
+            for (auto& statement : parser.parse_program())
+                output.line(statement);
+            if (simplify)
+                std::cerr << "Simplifying removed " << simplified.removed << " nodes." << std::endl;
+        } else {
+            simplifier simplified;
+            auto parser = parser::from_range(begin, end, nodes);
+            parser.iterative = iterative;
+            parser.max_depth = max_depth;
+            parser.simplify = simplify ? &simplified : nullptr;
+            parser.shared = shared.get();
+            auto statements = parser.parse_program();
+            for (auto& statement : statements)
+                output.line(statement);
+            // The parser keeps its latest failure, so any failure at all
+            // leaves the program uncached and its errors reported next time.
+            if (cache && parser.error) {
+                std::cerr << "Not saving " << cache << ", as the program has errors." << std::endl;
+            } else if (cache) {
+                try {
+                    syntax_image::save(cache, syntax_image::serialize(statements, begin, end, parsed));
+                } catch(const std::system_error& e) {
+                    std::cerr << e.what() << std::endl;
+                }
+            }
+            if (simplify)
+                std::cerr << "Simplifying removed " << simplified.removed << " nodes." << std::endl;
+        }
+        if (shared)
+            std::cerr << "Sharing kept " << shared->unique << " of " << shared->seen << " nodes, in "
+                << shared->bytes() << " bytes instead of " << shared->tree_bytes << ", with a table of "
+                << shared->table_bytes() << " bytes." << std::endl;
+        output.flush();
+        return EXIT_SUCCESS;
+    }
 
-int main() {
     auto short_welcome = "Welcome to the recursive decent AST parser.";
     auto long_welcome = 
         "Input a line of code, and the parser will return the AST. "
-        "Exit by closing input stream e.g. ctrl+d (unix) or ctrl+z (win).";
+        "Exit by closing input stream e.g. ctrl+d (unix) or ctrl+z (win). "
+        "Enter :stats for parser statistics.";
     auto prompt = "parser> ";
 
     std::cout << short_welcome << std::endl;
     std::cout << long_welcome << std::endl;
     std::cout << std::endl << prompt << std::flush;
 
+    compiler compiler;
+    vm machine;
+    simplifier simplified;
+    if (memo) {
+        memo->symbols = &compiler.symbols;
+        memo->simplify = simplify ? &simplified : nullptr;
+        memo->iterative = iterative;
+        memo->max_depth = max_depth;
+    }
+
     for ( // Infinite REPL loop
         std::string line;
         std::getline(std::cin, line);
         std::cout << prompt << std::flush
     ) {
 
-        auto statement = parser::from_string(line).parse();
-        std::cout << statement << std::endl;
+        // Dumps what parser_stats has counted on this thread so far.
+        if (line == ":stats") {
+            print(std::cout, parser_stats::current());
+            continue;
+        }
+
+        if (flat) {
+            std::cout << flat_syntax::from_string(line) << std::endl;
+            continue;
+        }
+
+        parse_cache::result cached;
+        syntax parsed;
+        if (memo) {
+            cached = memo->parse(line);
+            if (cached->failed())
+                std::cerr << cached->diagnostic;
+        } else {
+            auto parser = parser::from_string(line, nodes, &compiler.symbols);
+            parser.iterative = iterative;
+            parser.max_depth = max_depth;
+            parser.simplify = simplify ? &simplified : nullptr;
+            parsed = parser.parse();
+        }
+        auto& statement = cached ? cached->statement : parsed;
+        if (run && !statement.is_none()) {
+            try {
+                auto code = compiler.compile(statement);
+                print(std::cout, machine.run(code), code.result);
+                std::cout << std::endl;
+            } catch(const compiler::failure& f) {
+                std::cerr << "\033[1;31m" << f.message << "\033[0m" << std::endl;
+            } catch(const vm::failure& f) {
+                std::cerr << "\033[1;31m" << f.message << "\033[0m" << std::endl;
+            }
+        } else
+            std::cout << statement << std::endl;
+        if (nodes)
+            nodes->reset();
     }
 
     std::cout << "Exiting REPL..." << std::endl;
+    if (memo)
+        std::cerr << "Parse cache: " << memo->hits << " hits, " << memo->misses << " misses, "
+            << memo->evictions << " evictions, " << memo->size() << " entries in " << memo->bytes << " bytes." << std::endl;
 
     return EXIT_SUCCESS;
 }
@@ -1,55 +1,205 @@
 #pragma once
 #include "syntax.hpp"
+#include "simplify.hpp"
+#include "hash_cons.hpp"
 #include "token.hpp"
+#include "token_buffer.hpp"
 
 #include <memory>
-#include <cmath>
+#include <optional>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+#include <climits>
 #include <cassert>
 
-struct parser {
-    string_tokenizer tokenizer;
+// A binary operator: the token it is written as, the syntax it builds and
+// how tightly it binds. Power 0 means the token is not a binary operator.
+struct binary_operator {
+    token::ENUM match;
+    syntax::ENUM kind;
+    uint8_t power;
+    bool right_associative;
+    // Whether the right operand may start with a unary operator without
+    // being put in parentheses.
+    bool unary_operand;
+};
+
+// The binary operators, and the compile-time lookup table from token kind
+// to operator.
+struct binary_operator_set {
+    enum POWER : uint8_t { COMPARISON = 1, SUM, PRODUCT };
+
+    // Adding an operator is a token, a syntax kind and an entry here.
+    static constexpr binary_operator all[] = {
+        {token::LESSER_EQUAL,  syntax::LESS_EQUAL,     COMPARISON, false, true},
+        {token::GREATER_EQUAL, syntax::GREATER_EQUAL,  COMPARISON, false, true},
+        {token::BANG_EQUAL,    syntax::NOT_EQUAL,      COMPARISON, false, true},
+        {token::EQUAL_EQUAL,   syntax::EQUAL,          COMPARISON, false, true},
+        {token::LESSER,        syntax::LESS,           COMPARISON, false, true},
+        {token::GREATER,       syntax::GREATER,        COMPARISON, false, true},
+        {token::PLUS,          syntax::ADDITION,       SUM,        false, false},
+        {token::MINUS,         syntax::SUBTRACTION,    SUM,        false, false},
+        {token::STAR,          syntax::MULTIPLICATION, PRODUCT,    false, false},
+        {token::SLASH,         syntax::DIVITION,       PRODUCT,    false, false},
+    };
+
+    static constexpr size_t slots = 256;
+    static_assert(token::BAD_NUMBER < slots, "Token kinds must fit in a byte.");
+
+    struct table_t {
+        binary_operator entries[slots];
+    };
+
+    static constexpr table_t build() {
+        table_t table = {};
+        for (auto& op : all)
+            table.entries[op.match] = op;
+        return table;
+    }
+};
+
+struct binary_operators : binary_operator_set {
+    static constexpr table_t table = build();
+
+    static constexpr const binary_operator& find(token::ENUM kind) {
+        return table.entries[uint8_t(kind)];
+    }
+};
+
+// The grammar is written once against a node type; `syntax` builds the
+// pointer tree and `flat_syntax::node` appends to a flat node pool. Tokens
+// come from a string_tokenizer, or from a token_buffer::cursor when the
+// input was tokenized up front.
+template <typename node, typename tokens = string_tokenizer>
+struct basic_parser {
+    using allocator = typename node::allocator;
+
+    tokens tokenizer;
+    // The window of tokens read from a tokenizer. A token_buffer is instead
+    // read in place, by index: kinds straight from its array, and whole
+    // tokens only rebuilt where the grammar needs a value, name or position.
     token previous_token, current_token, next_token;
+    static constexpr bool indexed = std::is_same_v<tokens, token_buffer::cursor>;
+
+    // When set, every node of the parsed syntax is allocated from here. For
+    // `syntax` this is an arena, and the syntax is only valid for as long as
+    // the arena is not reset.
+    std::shared_ptr<allocator> nodes;
+
+    // When set, `syntax` statements are simplified as soon as they are parsed.
+    simplifier* simplify = nullptr;
+
+    // When set, `syntax` statements are interned here once parsed, so that
+    // identical subtrees across all statements share one node.
+    hash_cons* shared = nullptr;
+
+    // When set, expressions are parsed with an explicit stack on the heap
+    // instead of by recursion, so only max_depth limits how deeply groups
+    // nest.
+    bool iterative = false;
+
+    // The deepest nesting of groups accepted, in either mode. The recursive
+    // parser uses a few hundred bytes of stack per level.
+    unsigned max_depth = 1000;
+    unsigned depth = 0;
 
     struct failure {
         const char* title, *message, *after_message;
         token previous_token, bad_token;
     };
 
-    failure fail(const char* title, const char* message, const char* after_message = nullptr) {
-        return failure{title, message, after_message, previous_token, current_token};
+    // When set, failures are recorded here instead of being reported, and
+    // parse_program() keeps a failed node in place of each failed statement.
+    std::vector<failure>* diagnostics = nullptr;
+
+    // The failure behind the latest failed node. Errors are not thrown: a
+    // failed node is returned up through every caller instead.
+    std::optional<failure> error;
+
+    node fail(const char* title, const char* message, const char* after_message = nullptr) {
+        error = failure{title, message, after_message, previous(), current()};
+        return node::fail();
+    }
+
+    static basic_parser from_string(const std::string &str, std::shared_ptr<allocator> nodes = nullptr, symbol_table* symbols = nullptr) {
+        return from_range(str.data(), str.data() + str.length(), std::move(nodes), symbols);
     }
 
-    static parser from_string(const std::string &str) {
-        auto tokenizer = string_tokenizer::from_string(str);
+    // The parsed syntax points into [begin, end), which must outlive it. With
+    // a symbol table, identifiers are interned and carry their symbol.
+    static basic_parser from_range(const char* begin, const char* end, std::shared_ptr<allocator> nodes = nullptr, symbol_table* symbols = nullptr) {
+        return from_tokens(string_tokenizer::from_range(begin, end, symbols), std::move(nodes));
+    }
+
+    // Parses from any token source, e.g. a cursor over a token_buffer, which
+    // together with the source it points into must outlive the parser.
+    static basic_parser from_tokens(tokens tokenizer, std::shared_ptr<allocator> nodes = nullptr) {
+        if constexpr (indexed)
+            return basic_parser(tokenizer, tokenizer.peek(), tokenizer.peek(1), std::move(nodes));
         auto first = tokenizer.next();
         auto second = tokenizer.next();
-        return {tokenizer, token::begin_input(str.data()), first, second};
+        return basic_parser(tokenizer, first, second, std::move(nodes));
+    }
+
+    basic_parser(tokens tokenizer, token first, token second, std::shared_ptr<allocator> nodes)
+        : tokenizer(tokenizer), previous_token(token::begin_input(tokenizer.begin())),
+          current_token(first), next_token(second), nodes(std::move(nodes)) {}
+
+    token::ENUM current_kind() const {
+        if constexpr (indexed)
+            return tokenizer.kind();
+        return current_token.kind;
+    }
+
+    token::ENUM next_kind() const {
+        if constexpr (indexed)
+            return tokenizer.kind(1);
+        return next_token.kind;
+    }
+
+    // The current token in full: the window's own, or rebuilt from the buffer.
+    decltype(auto) current() const {
+        if constexpr (indexed)
+            return tokenizer.peek();
+        else
+            return (current_token);
+    }
+
+    token previous() const {
+        if constexpr (indexed)
+            return tokenizer.index ? (*tokenizer.buffer)[tokenizer.index - 1] : token::begin_input(tokenizer.begin());
+        return previous_token;
     }
 
     bool at_end() {
-        return current_token.kind == token::END_OF_INPUT;
+        return current_kind() == token::END_OF_INPUT;
     }
 
     template <typename T>
     bool match(T kind) {
-        return current_token.kind == (token::ENUM)kind;
+        return current_kind() == (token::ENUM)kind;
     }
 
     bool match(const char kind[3]) {
         return (
-            current_token.kind == (token::ENUM)(kind[0] + kind[1])
+            current_kind() == (token::ENUM)(kind[0] + kind[1])
         );
     }
 
     template <typename T1, typename T2>
     bool match(T1 current_kind, T2 next_kind) {
         return (
-            current_token.kind == (token::ENUM)current_kind &&
-            next_token.kind == (token::ENUM)next_kind
+            this->current_kind() == (token::ENUM)current_kind &&
+            this->next_kind() == (token::ENUM)next_kind
         );
     }
 
     void advance() {
+        if constexpr (indexed) {
+            ++tokenizer.index;
+            return;
+        }
         // std::cout << "Consumed token: " << current_token << std::endl;
         previous_token = current_token;
         current_token = next_token;
@@ -65,52 +215,95 @@ struct parser {
         return false;
     }
 
-    syntax number() {
-        if (match(token::INT)) {
-            auto num = syntax((long)current_token.int_value);
+    node number(bool negative = false) {
+        const auto& tkn = current();
+        if (match(token::INT) && (negative || tkn.int_value <= LONG_MAX)) {
+            auto value = tkn.int_value;
+            auto num = node(long(negative ? 0 - value : value));
             advance();
             return num;
         }
         if (match(token::FLOAT)) {
-            auto num = syntax(current_token.float_value);
+            auto value = tkn.float_value;
+            auto num = node(negative ? -value : value);
             advance();
             return num;
         }
-        return syntax::fail();
+        return fail(
+            "Number out of range!",
+            "Integers must be within [-9223372036854775808, 9223372036854775807], "
+            "and floats within the range of a double."
+        );
     }
 
-    syntax identifier() {
-        auto id = syntax(current_token.position, current_token.length);
+    node identifier() {
+        const auto& tkn = current();
+        if (tkn.length > syntax::max_name_length)
+            return fail(
+                "Identifier too long!",
+                "Identifiers can be at most 65535 characters long."
+            );
+        auto id = node(tkn.position, tkn.length, tkn.symbol);
         advance();
         return id;
     }
 
-    syntax literal() {
-        if (consume('(')) {
-            auto expr = expression();
-            if (consume(')'))
-                return expr;
-            else
-                throw fail("Unbalanced parenthesis!", "Expected a closing parenthesis ')'.");
-        }
-        if (consume("true"))
-            return syntax(true);
-        if (consume("false"))
-            return syntax(false);
+    node too_deep() {
+        return fail(
+            "Nesting too deep!",
+            "Groups are nested deeper than the parser's nesting limit."
+        );
+    }
 
-        auto expr = match(token::IDENTIFIER) ? identifier() : number();
+    node literal() {
+        if (consume('('))
+            return group();
+        return primary();
+    }
 
-        if (expr.failed())
-            throw fail(
-                "Missing value!",
-                "Expected a literal value after ", /*previous_token*/
-                " e.g. group, identifier, number, or boolean."
-            );
+    // The rest of a group, after its '('.
+    node group() {
+        if (++depth > max_depth)
+            return too_deep();
+        parser_stats::depth(depth);
+        auto expr = expression();
+        --depth;
+        if (expr.failed() || consume(')'))
+            return expr;
+        else
+            return fail("Unbalanced parenthesis!", "Expected a closing parenthesis ')'.");
+    }
 
-        return expr;
+    // Whether a sign is followed by a number alone in a group, as in -(3),
+    // which is folded like a signed number. Only the '(' is consumed.
+    bool signed_group(syntax::ENUM unary_kind) {
+        if ((unary_kind != syntax::PLUS && unary_kind != syntax::MINUS) || depth >= max_depth)
+            return false;
+        if (!match('(', token::INT) && !match('(', token::FLOAT))
+            return false;
+        advance();
+        return true;
+    }
+
+    // A literal other than a group.
+    node primary() {
+        if (consume(token::TRUE))
+            return node(true);
+        if (consume(token::FALSE))
+            return node(false);
+        if (match(token::IDENTIFIER))
+            return identifier();
+        if (match(token::INT) || match(token::FLOAT) || match(token::BAD_NUMBER))
+            return number();
+
+        return fail(
+            "Missing value!",
+            "Expected a literal value after ", /*previous_token*/
+            " e.g. group, identifier, number, or boolean."
+        );
     }
 
-    syntax unary() {
+    node unary() {
         syntax::ENUM unary_kind = syntax::NONE;
 
         if (consume('+')) {
@@ -122,128 +315,177 @@ struct parser {
         } else
             return literal();
 
-        auto inner = literal();
-
-        if (
-            unary_kind == syntax::PLUS && (
-                inner.kind == syntax::INT || inner.kind == syntax::FLOAT
-            )
-        ) return inner; // NO-OP
-
-        if (unary_kind == syntax::MINUS && inner.kind == syntax::INT)
-            inner.int_value = -inner.int_value;
-        if (unary_kind == syntax::MINUS && inner.kind == syntax::FLOAT)
-            inner.float_value = -inner.float_value;
+        // Signed numbers are folded into the literal.
+        auto grouped = signed_group(unary_kind);
+        auto folded = grouped ? match(token::INT, ')') || match(token::FLOAT, ')') : match(token::INT) || match(token::FLOAT);
+        if (unary_kind != syntax::NOT && folded) {
+            auto num = number(unary_kind == syntax::MINUS);
+            if (grouped && !num.failed())
+                advance();
+            return num;
+        }
 
-        return syntax(unary_kind, std::move(inner));
+        auto inner = grouped ? group() : literal();
+        if (inner.failed())
+            return inner;
+        return node(unary_kind, std::move(inner));
     }
 
-    syntax product() {
+    // Precedence climbing: parses an operand, then every following binary
+    // operator that binds at least as tightly as min_power, so an operand
+    // takes one call however many precedence levels there are.
+    node binary(unsigned min_power) {
         auto expr = unary();
 
-        while (!at_end()) {
-            if (consume('/')) {
-                if (match('+') || match('-') || match('!'))
-                    throw fail(
-                        "Invalid syntax!",
-                        "Unary operators must be surrounded by '(' and ')' when "
-                        "used on the right of a binary expression."
-                    );
-                expr = syntax(syntax::DIVITION, std::move(expr), literal());
-            } else if (consume('*')) {
-                if (match('+') || match('-') || match('!'))
-                    throw fail(
-                        "Invalid syntax!",
-                        "Unary operators must be surrounded by '(' and ')' when "
-                        "used on the right of a binary expression."
-                    );
-                expr = syntax(syntax::MULTIPLICATION, std::move(expr), literal());
-            } else
+        while (!expr.failed()) {
+            auto& op = binary_operators::find(current_kind());
+            if (op.power == 0 || op.power < min_power)
                 break;
+            advance();
+            if (!op.unary_operand && (match('+') || match('-') || match('!')))
+                return fail(
+                    "Invalid syntax!",
+                    "Unary operators must be surrounded by '(' and ')' when "
+                    "used on the right of a binary expression."
+                );
+            auto right = binary(op.right_associative ? op.power : op.power + 1);
+            if (right.failed())
+                return right;
+            expr = node(op.kind, std::move(expr), std::move(right));
         }
 
         return expr;
     }
 
-    syntax sum() {
-        auto expr = product();
-
-        while (!at_end()) {
-            if (consume('+')) {
-                if (match('+') || match('-') || match('!'))
-                    throw fail(
-                        "Invalid syntax!",
-                        "Unary operators must be surrounded by '(' and ')' when "
-                        "used on the right of a binary expression."
-                    );
-                expr = syntax(syntax::ADDITION, std::move(expr), product());
-            } else if (consume('-')) {
-                if (match('+') || match('-') || match('!'))
-                    throw fail(
-                        "Invalid syntax!",
-                        "Unary operators must be surrounded by '(' and ')' when "
-                        "used on the right of a binary expression."
-                    );
-                expr = syntax(syntax::SUBTRACTION, std::move(expr), product());
-            } else
-                break;
+    // An open group, unary operator or binary operator of an iterative parse,
+    // with the min_power of the expression around it.
+    struct frame {
+        enum TYPE { GROUP, UNARY, BINARY } type;
+        syntax::ENUM kind;
+        unsigned min_power;
+        node left;
+    };
+    std::vector<frame> frames;
+
+    // The same grammar as binary(1), with what would be the call stack kept
+    // in frames: each operand opens frames for its unary operator and groups,
+    // and once it is complete, frames are closed until an operator binds.
+    node iterative_expression() {
+        auto failed = [&](node failure) {
+            frames.clear();
+            return failure;
+        };
+        unsigned min_power = 1;
+        node expr;
+
+        for (;;) {
+            syntax::ENUM unary_kind = syntax::NONE;
+            if (consume('+'))
+                unary_kind = syntax::PLUS;
+            else if (consume('-'))
+                unary_kind = syntax::MINUS;
+            else if (consume('!'))
+                unary_kind = syntax::NOT;
+
+            // Signed numbers are folded into the literal.
+            auto grouped = signed_group(unary_kind);
+            auto folded = grouped ? match(token::INT, ')') || match(token::FLOAT, ')') : match(token::INT) || match(token::FLOAT);
+            if ((unary_kind == syntax::PLUS || unary_kind == syntax::MINUS) && folded) {
+                expr = number(unary_kind == syntax::MINUS);
+                if (grouped && !expr.failed())
+                    advance();
+            } else {
+                if (unary_kind != syntax::NONE)
+                    frames.push_back({frame::UNARY, unary_kind, min_power, node()});
+                if (grouped || consume('(')) {
+                    if (++depth > max_depth)
+                        return failed(too_deep());
+                    parser_stats::depth(depth);
+                    frames.push_back({frame::GROUP, syntax::NONE, min_power, node()});
+                    min_power = 1;
+                    continue;
+                }
+                expr = primary();
+            }
+            if (expr.failed())
+                return failed(std::move(expr));
+
+            for (;;) {
+                while (!frames.empty() && frames.back().type == frame::UNARY) {
+                    expr = node(frames.back().kind, std::move(expr));
+                    frames.pop_back();
+                }
+
+                auto& op = binary_operators::find(current_kind());
+                if (op.power != 0 && op.power >= min_power) {
+                    advance();
+                    if (!op.unary_operand && (match('+') || match('-') || match('!')))
+                        return failed(fail(
+                            "Invalid syntax!",
+                            "Unary operators must be surrounded by '(' and ')' when "
+                            "used on the right of a binary expression."
+                        ));
+                    frames.push_back({frame::BINARY, op.kind, min_power, std::move(expr)});
+                    min_power = op.right_associative ? op.power : op.power + 1;
+                    break;
+                }
+
+                if (frames.empty())
+                    return expr;
+                auto& top = frames.back();
+                if (top.type == frame::BINARY) {
+                    expr = node(top.kind, std::move(top.left), std::move(expr));
+                } else {
+                    if (!consume(')'))
+                        return failed(fail("Unbalanced parenthesis!", "Expected a closing parenthesis ')'."));
+                    --depth;
+                }
+                min_power = top.min_power;
+                frames.pop_back();
+            }
         }
-
-        return expr;
     }
 
-    syntax comparison() {
-        auto expr = sum();
-
-        while (!at_end()) {
-            if (consume("<="))
-                expr = syntax(syntax::LESS_EQUAL, std::move(expr), sum());
-            else if (consume(">="))
-                expr = syntax(syntax::GREATER_EQUAL, std::move(expr), sum());
-            else if (consume("!="))
-                expr = syntax(syntax::NOT_EQUAL, std::move(expr), sum());
-            else if (consume("=="))
-                expr = syntax(syntax::EQUAL, std::move(expr), sum());
-            else if (consume('<'))
-                expr = syntax(syntax::LESS, std::move(expr), sum());
-            else if (consume('>'))
-                expr = syntax(syntax::GREATER, std::move(expr), sum());
-            else
-                break;
-        }
-
-        return expr;
+    node expression() {
+        return iterative ? iterative_expression() : binary(1);
     }
 
-    syntax expression() {
-        return comparison();
-    }
-
-    syntax assignment() {
+    node assignment() {
         auto var = identifier();
+        if (var.failed())
+            return var;
         assert(consume('='));  // We already checked this in statement()!!
         auto expr = expression();
+        if (expr.failed())
+            return expr;
 
-        return syntax(syntax::ASSIGNMENT, std::move(var), std::move(expr));
+        return node(syntax::ASSIGNMENT, std::move(var), std::move(expr));
     }
 
-    syntax declaration() {
+    node declaration() {
         auto var = identifier();
+        if (var.failed())
+            return var;
         assert(consume(':'));  // We already checked this in statement()!!
-        auto type = match(token::IDENTIFIER) ? identifier() : syntax::none();
-        auto expr = consume('=') ? expression() : syntax::none();
+        auto type = match(token::IDENTIFIER) ? identifier() : node::none();
+        if (type.failed())
+            return type;
+        auto expr = consume('=') ? expression() : node::none();
+        if (expr.failed())
+            return expr;
 
         if (type.is_none() && expr.is_none())
-            throw fail(
+            return fail(
                 "Malformed variable declaration!",
                 "You must declare a variable with either a type or an expression."
             );
 
-        return syntax(std::move(var), std::move(type), std::move(expr));
+        return node(std::move(var), std::move(type), std::move(expr));
     }
 
-    syntax statement() {
-        syntax stmt;
+    node statement() {
+        node stmt;
+        depth = 0;
 
         if (match(token::IDENTIFIER, ':'))
             stmt = declaration();
@@ -251,40 +493,155 @@ struct parser {
             stmt = assignment();
         else 
             stmt = expression();
-        
+        if (stmt.failed())
+            return stmt;
+
         if (!at_end() && !consume('\n') && !consume(';'))
-            throw fail(
+            return fail(
                 "Missing end of statement!",
                 "You must cannot be followed by anything other than a newline or a semicolon ';'"
             );
 
+        // The simplifier rewrites the tree in place, so it runs before the
+        // nodes are shared.
+        if constexpr (std::is_same_v<node, syntax>) {
+            if (simplify)
+                simplify->run(stmt);
+            if (shared)
+                stmt = shared->intern(stmt);
+        }
+
         return stmt;
     }
 
-    syntax parse() {
-        try {
-            return statement();
-        } catch(const failure& f) {
-            std::cerr << "\033[1;31m";
-            std::cerr << f.title << '\n';
-            std::cerr << "The use of '" << f.bad_token << "' is not supported here:\n";
-            std::cerr << "\033[0m";
-            std::cerr << tokenizer.scanner.source << '\n';
-            std::cerr << "\033[1;32m";
-            int position = f.bad_token.position - tokenizer.scanner.source;
-            for (int i = 0; i < position; ++i)
-                std::cerr << ' ';
-            for (int i = 0; i < f.bad_token.length; ++i)
-                std::cerr << "↑";
-            std::cerr << '\n';
-            std::cerr << "\033[1;31m";
-            if (f.after_message)
-                std::cerr << f.message << "'" << f.previous_token << "'" << f.after_message << '\n';
-            else
-                std::cerr << f.message << '\n';
-            std::cerr << "\033[0m";
+    // Describes the failure with the source line it occurred on.
+    std::string describe(const failure& f) const {
+        return describe(f, tokenizer.begin(), tokenizer.end());
+    }
+
+    // The same, for a parser that only saw part of [source, source_end), so
+    // the whole line is shown even where the part was cut from it.
+    static std::string describe(const failure& f, const char* source, const char* source_end) {
+        auto line = f.bad_token.position;
+        while (line > source && line[-1] != '\n')
+            --line;
+        auto line_end = f.bad_token.position;
+        while (line_end < source_end && *line_end != '\n')
+            ++line_end;
+
+        std::ostringstream message;
+        message << "\033[1;31m";
+        message << f.title << '\n';
+        message << "The use of '" << f.bad_token << "' is not supported here:\n";
+        message << "\033[0m";
+        message << std::string_view(line, line_end - line) << '\n';
+        message << "\033[1;32m";
+        for (auto i = line; i < f.bad_token.position; ++i)
+            message << ' ';
+        ulong width = 1;
+        if (f.bad_token.kind == token::IDENTIFIER || f.bad_token.kind == token::BAD_NUMBER)
+            width = f.bad_token.length;
+        for (ulong i = 0; i < width; ++i)
+            message << "↑";
+        message << '\n';
+        message << "\033[1;31m";
+        if (f.after_message)
+            message << f.message << "'" << f.previous_token << "'" << f.after_message << '\n';
+        else
+            message << f.message << '\n';
+        message << "\033[0m";
+        return message.str();
+    }
+
+    void report(const failure& f) const {
+        // Written with a single call, so reports from parallel parsers don't interleave.
+        std::cerr << describe(f);
+    }
+
+    // Skips the rest of a failed statement, including its ";" or "\n".
+    void synchronize() {
+        while (!at_end() && !match('\n') && !match(';'))
+            advance();
+        if (!consume('\n'))
+            consume(';');
+    }
+
+    node parse() {
+        parser_stats::phase timed(&parser_stats::parse_ns);
+        typename allocator::scope allocate_from(nodes.get());
+        auto stmt = statement();
+        if (!stmt.failed())
+            return stmt;
+
+        parser_stats::error();
+        if (diagnostics)
+            diagnostics->push_back(*error);
+        else
+            report(*error);
+        return node::none();
+    }
+
+    // Parses every statement in the input with the same tokenizer and
+    // allocator. Empty statements are skipped, and a failed statement is
+    // reported and kept as none so the list lines up with the input. With
+    // diagnostics, every failure is recorded in one pass over the input.
+    std::vector<node> parse_program() {
+        parser_stats::phase timed(&parser_stats::parse_ns);
+        typename allocator::scope allocate_from(nodes.get());
+        std::vector<node> statements;
+
+        while (!at_end()) {
+            if (consume('\n') || consume(';'))
+                continue;
+            auto stmt = statement();
+            if (stmt.failed()) {
+                parser_stats::error();
+                if (diagnostics)
+                    diagnostics->push_back(*error);
+                else
+                    report(*error);
+                synchronize();
+                if (!diagnostics)
+                    stmt = node::none();
+            }
+            statements.push_back(std::move(stmt));
         }
 
-        return syntax::none();
+        return statements;
     }
 };
+
+// Prints the counters of parser_stats that are not zero.
+void print(std::ostream &str, const parser_stats &stats) {
+    if (!parser_stats::enabled) {
+        str << "Statistics are not compiled in; build with -DPARSER_STATS=1." << std::endl;
+        return;
+    }
+    str << "time: tokenize " << stats.tokenize_ns / 1e6 << " ms, parse " << stats.parse_ns / 1e6
+        << " ms, print " << stats.print_ns / 1e6 << " ms" << std::endl;
+
+    uint64_t total = 0;
+    for (auto count : stats.tokens)
+        total += count;
+    str << "tokens: " << total;
+    for (unsigned kind = 0; kind < 256; ++kind)
+        if (stats.tokens[kind])
+            str << ", " << token::name(token::ENUM(kind)) << " " << stats.tokens[kind];
+    str << std::endl;
+
+    total = 0;
+    for (auto count : stats.nodes)
+        total += count;
+    str << "nodes: " << total;
+    for (unsigned kind = 0; kind <= syntax::BOOL; ++kind)
+        if (stats.nodes[kind])
+            str << ", " << syntax_printer::kind_name(syntax::ENUM(kind)) << " " << stats.nodes[kind];
+    str << std::endl;
+
+    str << "allocations: " << stats.allocations << ", " << stats.allocated_bytes << " bytes" << std::endl;
+    str << "max depth: " << stats.max_depth << std::endl;
+    str << "errors: " << stats.errors << std::endl;
+}
+
+using parser = basic_parser<syntax>;
+using buffered_parser = basic_parser<syntax, token_buffer::cursor>;
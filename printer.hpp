@@ -0,0 +1,346 @@
+#pragma once
+#include "syntax.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+// Prints syntax into one growable buffer, and writes the buffer out with a
+// single write() once it holds a batch. Trees are walked with an explicit
+// stack rather than by recursion, so no tree is too deep to print, and
+// numbers are formatted with to_chars instead of through a stream.
+//
+// TEXT is the format of operator<<, SEXPR a compact S-expression such as
+// (+ a (* 2 b)), and JSON one object per node.
+struct syntax_printer {
+    enum FORMAT { TEXT, SEXPR, JSON };
+
+    FORMAT format = TEXT;
+    int fd = -1;                   // Where flush() writes to, or -1 to only buffer.
+    size_t batch_size = 1 << 16;   // line() flushes once the buffer holds this much.
+    std::string buffer;
+
+    syntax_printer(int fd = -1, FORMAT format = TEXT) : format(format), fd(fd) {}
+    syntax_printer(const syntax_printer&) = delete;
+    syntax_printer& operator=(const syntax_printer&) = delete;
+    ~syntax_printer() {
+        try {
+            flush();
+        } catch(const std::system_error&) {
+            // Nowhere left to report it.
+        }
+    }
+
+    static bool parse_format(const std::string &name, FORMAT &format) {
+        if (name == "text")
+            format = TEXT;
+        else if (name == "sexpr")
+            format = SEXPR;
+        else if (name == "json")
+            format = JSON;
+        else
+            return false;
+        return true;
+    }
+
+    // Prints the statement and a newline, flushing whole batches.
+    void line(const syntax &ast) {
+        print(ast);
+        buffer += '\n';
+        if (buffer.size() >= batch_size)
+            flush();
+    }
+
+    void print(const syntax &ast);
+
+    static const char* kind_name(syntax::ENUM kind) {
+        switch (kind) {
+            case syntax::NONE:           return "NONE";
+            case syntax::FAILED:         return "FAILED";
+            case syntax::DECLARATION:    return "DECLARATION";
+            case syntax::ADDITION:       return "ADDITION";
+            case syntax::SUBTRACTION:    return "SUBTRACTION";
+            case syntax::MULTIPLICATION: return "MULTIPLICATION";
+            case syntax::DIVITION:       return "DIVISION";
+            case syntax::LESS:           return "LESS";
+            case syntax::GREATER:        return "GREATER";
+            case syntax::LESS_EQUAL:     return "LESS_EQUAL";
+            case syntax::GREATER_EQUAL:  return "GREATER_EQUAL";
+            case syntax::NOT_EQUAL:      return "NOT_EQUAL";
+            case syntax::EQUAL:          return "EQUAL";
+            case syntax::ASSIGNMENT:     return "ASSIGNMENT";
+            case syntax::PLUS:           return "PLUS";
+            case syntax::MINUS:          return "MINUS";
+            case syntax::NOT:            return "NOT";
+            case syntax::IDENTIFIER:     return "IDENTIFIER";
+            case syntax::INT:            return "INT";
+            case syntax::FLOAT:          return "FLOAT";
+            case syntax::BOOL:           return "BOOL";
+        }
+        return "";
+    }
+
+    void flush() {
+        if (fd < 0)
+            return;
+        size_t written = 0;
+        while (written < buffer.size()) {
+            auto result = ::write(fd, buffer.data() + written, buffer.size() - written);
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result < 0)
+                throw std::system_error(errno, std::generic_category(), "write");
+            written += size_t(result);
+        }
+        buffer.clear();
+    }
+
+private:
+    // A node still to be printed, or text still to be appended after it.
+    struct step {
+        const syntax* node;
+        std::string_view text;
+    };
+    std::vector<step> pending;
+
+    void then(const syntax &node) { pending.push_back({&node, {}}); }
+    void then(const char* text) { pending.push_back({nullptr, text}); }
+
+    void append(std::string_view text) { buffer.append(text.data(), text.size()); }
+
+    void append(long value) {
+        char digits[24];
+        auto end = std::to_chars(digits, digits + sizeof digits, value).ptr;
+        buffer.append(digits, end);
+    }
+
+    // TEXT prints floats like an ostream does, with 6 significant digits;
+    // the other formats print the shortest digits that read back exactly.
+    void append(double value, bool shortest) {
+        char digits[32];
+        auto end = shortest
+            ? std::to_chars(digits, digits + sizeof digits, value).ptr
+            : std::to_chars(digits, digits + sizeof digits, value, std::chars_format::general, 6).ptr;
+        buffer.append(digits, end);
+    }
+
+    static const char* operator_text(syntax::ENUM kind) {
+        switch (kind) {
+            case syntax::ADDITION:       return "+";
+            case syntax::SUBTRACTION:    return "-";
+            case syntax::MULTIPLICATION: return "*";
+            case syntax::DIVITION:       return "/";
+            case syntax::NOT_EQUAL:      return "!=";
+            case syntax::EQUAL:          return "==";
+            case syntax::LESS:           return "<";
+            case syntax::GREATER:        return ">";
+            case syntax::LESS_EQUAL:     return "<=";
+            case syntax::GREATER_EQUAL:  return ">=";
+            case syntax::ASSIGNMENT:     return "=";
+            case syntax::PLUS:           return "+";
+            case syntax::MINUS:          return "-";
+            case syntax::NOT:            return "!";
+            default:                     return "";
+        }
+    }
+
+    static const char* infix_text(syntax::ENUM kind) {
+        switch (kind) {
+            case syntax::ADDITION:       return " + ";
+            case syntax::SUBTRACTION:    return " - ";
+            case syntax::MULTIPLICATION: return " * ";
+            case syntax::DIVITION:       return " / ";
+            case syntax::NOT_EQUAL:      return " != ";
+            case syntax::EQUAL:          return " == ";
+            case syntax::LESS:           return " < ";
+            case syntax::GREATER:        return " > ";
+            case syntax::LESS_EQUAL:     return " <= ";
+            case syntax::GREATER_EQUAL:  return " >= ";
+            case syntax::ASSIGNMENT:     return " = ";
+            default:                     return "";
+        }
+    }
+
+    const syntax* text(const syntax &ast);
+    const syntax* sexpr(const syntax &ast);
+    const syntax* json(const syntax &ast);
+};
+
+void syntax_printer::print(const syntax &ast) {
+    parser_stats::phase timed(&parser_stats::print_ns);
+    auto node = &ast;
+    for (;;) {
+        while (node)
+            node = format == TEXT ? text(*node) : format == SEXPR ? sexpr(*node) : json(*node);
+        if (pending.empty())
+            return;
+        auto next = pending.back();
+        pending.pop_back();
+        if (next.node)
+            node = next.node;
+        else
+            append(next.text);
+    }
+}
+
+// Each of these prints what comes before the first operand, pushes the rest
+// in reverse, as the stack pops the last step first, and returns the first
+// operand to print next. Leaves return nullptr.
+
+const syntax* syntax_printer::text(const syntax &ast) {
+    switch (ast.kind) {
+        case syntax::DECLARATION:
+            append("(");
+            then(")"); then(ast.value()); then(" = "); then(ast.type()); then(": ");
+            return &ast.var();
+        case syntax::ADDITION:
+        case syntax::SUBTRACTION:
+        case syntax::MULTIPLICATION:
+        case syntax::DIVITION:
+        case syntax::NOT_EQUAL:
+        case syntax::EQUAL:
+        case syntax::LESS:
+        case syntax::GREATER:
+        case syntax::LESS_EQUAL:
+        case syntax::GREATER_EQUAL:
+        case syntax::ASSIGNMENT:
+            append("(");
+            then(")"); then(ast.right()); then(infix_text(ast.kind));
+            return &ast.left();
+        case syntax::PLUS:
+        case syntax::MINUS:
+        case syntax::NOT:
+            append("("); append(operator_text(ast.kind)); append(" ");
+            then(")");
+            return &ast.inner();
+        case syntax::IDENTIFIER:
+            append("'"); append(ast.identifier()); append("'id"); break;
+        case syntax::INT:
+            append(ast.int_value); append("i"); break;
+        case syntax::FLOAT:
+            append(ast.float_value, false); append("f"); break;
+        case syntax::BOOL:
+            append(ast.bool_value ? "true" : "false"); break;
+        case syntax::FAILED:
+            append("failed"); break;
+        case syntax::NONE:
+            append("none"); break;
+    }
+    return nullptr;
+}
+
+const syntax* syntax_printer::sexpr(const syntax &ast) {
+    switch (ast.kind) {
+        case syntax::DECLARATION:
+            append("(: ");
+            then(")"); then(ast.value()); then(" "); then(ast.type()); then(" ");
+            return &ast.var();
+        case syntax::ADDITION:
+        case syntax::SUBTRACTION:
+        case syntax::MULTIPLICATION:
+        case syntax::DIVITION:
+        case syntax::NOT_EQUAL:
+        case syntax::EQUAL:
+        case syntax::LESS:
+        case syntax::GREATER:
+        case syntax::LESS_EQUAL:
+        case syntax::GREATER_EQUAL:
+        case syntax::ASSIGNMENT:
+            append("("); append(operator_text(ast.kind)); append(" ");
+            then(")"); then(ast.right()); then(" ");
+            return &ast.left();
+        case syntax::PLUS:
+        case syntax::MINUS:
+        case syntax::NOT:
+            append("("); append(operator_text(ast.kind)); append(" ");
+            then(")");
+            return &ast.inner();
+        case syntax::IDENTIFIER:
+            append(ast.identifier()); break;
+        case syntax::INT:
+            append(ast.int_value); break;
+        case syntax::FLOAT: {
+            // Floats always show a '.' or an exponent, so they read back as floats.
+            auto start = buffer.size();
+            append(ast.float_value, true);
+            if (std::isfinite(ast.float_value) && buffer.find_first_of(".e", start) == std::string::npos)
+                append(".0");
+            break;
+        }
+        case syntax::BOOL:
+            append(ast.bool_value ? "true" : "false"); break;
+        case syntax::FAILED:
+            append("failed"); break;
+        case syntax::NONE:
+            append("none"); break;
+    }
+    return nullptr;
+}
+
+// Identifiers are ASCII letters, digits and underscores, so names are
+// written into JSON strings without escaping.
+const syntax* syntax_printer::json(const syntax &ast) {
+    if (ast.kind == syntax::NONE) {
+        append("null");
+        return nullptr;
+    }
+    append("{\"kind\":\""); append(kind_name(ast.kind)); append("\"");
+    switch (ast.kind) {
+        case syntax::DECLARATION:
+            append(",\"var\":");
+            then("}"); then(ast.value()); then(",\"value\":"); then(ast.type()); then(",\"type\":");
+            return &ast.var();
+        case syntax::ADDITION:
+        case syntax::SUBTRACTION:
+        case syntax::MULTIPLICATION:
+        case syntax::DIVITION:
+        case syntax::NOT_EQUAL:
+        case syntax::EQUAL:
+        case syntax::LESS:
+        case syntax::GREATER:
+        case syntax::LESS_EQUAL:
+        case syntax::GREATER_EQUAL:
+        case syntax::ASSIGNMENT:
+            append(",\"left\":");
+            then("}"); then(ast.right()); then(",\"right\":");
+            return &ast.left();
+        case syntax::PLUS:
+        case syntax::MINUS:
+        case syntax::NOT:
+            append(",\"inner\":");
+            then("}");
+            return &ast.inner();
+        case syntax::IDENTIFIER:
+            append(",\"name\":\""); append(ast.identifier()); append("\""); break;
+        case syntax::INT:
+            append(",\"value\":"); append(ast.int_value); break;
+        case syntax::FLOAT:
+            // JSON has no infinities or NaN.
+            append(",\"value\":");
+            if (std::isfinite(ast.float_value))
+                append(ast.float_value, true);
+            else
+                append("null");
+            break;
+        case syntax::BOOL:
+            append(",\"value\":"); append(ast.bool_value ? "true" : "false"); break;
+        default:
+            break;
+    }
+    append("}");
+    return nullptr;
+}
+
+std::ostream& operator<<(std::ostream &str, const syntax& ast) {
+    static thread_local syntax_printer printer;
+    printer.buffer.clear();
+    printer.print(ast);
+    return str.write(printer.buffer.data(), printer.buffer.size());
+}
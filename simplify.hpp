@@ -0,0 +1,255 @@
+#pragma once
+#include "syntax.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// Folds constant subtrees of arithmetic, comparisons and '!', and applies
+// identities such as x * 1, x + 0 and !!b. Folding follows the bytecode VM:
+// ints wrap around, an int mixed with a float is a float, and an integer
+// division by zero is left to fail at run time.
+//
+// Identities only apply where the operand is known to have the type the
+// operator requires, e.g. a number for x * 1 and a bool for !!b. An
+// identifier could be either, so `b * 1` is left for the compiler to reject
+// if b is a bool.
+struct simplifier {
+    size_t removed = 0;  // Nodes removed so far
+
+    // Simplifies bottom-up, with an explicit stack rather than recursion, so
+    // no tree the parser accepts is too deep to simplify.
+    void run(syntax& ast) {
+        pending.push_back({&ast, false});
+        while (!pending.empty()) {
+            auto& top = pending.back();
+            auto& node = *top.node;
+            if (!top.expanded) {
+                top.expanded = true;  // Before expand() may move top.
+                if (expand(node))
+                    continue;
+            }
+            pending.pop_back();
+            leave(node);
+        }
+    }
+
+private:
+    // A node still to be simplified, and whether its operands are pushed.
+    struct frame {
+        syntax* node;
+        bool expanded;
+    };
+    std::vector<frame> pending;
+
+    // Pushes the operands that are simplified, and returns false if none.
+    bool expand(syntax& ast) {
+        switch (ast.kind) {
+            case syntax::DECLARATION:
+                pending.push_back({&ast.value(), false}); return true;
+            case syntax::ASSIGNMENT:
+                pending.push_back({&ast.right(), false}); return true;
+            case syntax::ADDITION:
+            case syntax::SUBTRACTION:
+            case syntax::MULTIPLICATION:
+            case syntax::DIVITION:
+            case syntax::NOT_EQUAL:
+            case syntax::EQUAL:
+            case syntax::LESS:
+            case syntax::GREATER:
+            case syntax::LESS_EQUAL:
+            case syntax::GREATER_EQUAL:
+                pending.push_back({&ast.right(), false});
+                pending.push_back({&ast.left(), false});
+                return true;
+            case syntax::PLUS:
+            case syntax::MINUS:
+            case syntax::NOT:
+                pending.push_back({&ast.inner(), false}); return true;
+            default:
+                return false;
+        }
+    }
+
+    // Simplifies a node whose operands are already simplified.
+    void leave(syntax& ast) {
+        switch (ast.kind) {
+            case syntax::ADDITION:
+            case syntax::SUBTRACTION:
+            case syntax::MULTIPLICATION:
+            case syntax::DIVITION:
+            case syntax::NOT_EQUAL:
+            case syntax::EQUAL:
+            case syntax::LESS:
+            case syntax::GREATER:
+            case syntax::LESS_EQUAL:
+            case syntax::GREATER_EQUAL:
+                fold_binary(ast) || simplify_binary(ast);
+                break;
+            case syntax::PLUS:
+            case syntax::MINUS:
+            case syntax::NOT:
+                fold_unary(ast) || simplify_unary(ast);
+                break;
+            default:
+                break;
+        }
+    }
+
+    static bool number(const syntax& ast) {
+        return ast.kind == syntax::INT || ast.kind == syntax::FLOAT;
+    }
+
+    // Whether the node can only be a number, or only a bool, if it compiles.
+    static bool numeric(const syntax& ast) {
+        switch (ast.kind) {
+            case syntax::INT:
+            case syntax::FLOAT:
+            case syntax::ADDITION:
+            case syntax::SUBTRACTION:
+            case syntax::MULTIPLICATION:
+            case syntax::DIVITION:
+            case syntax::PLUS:
+            case syntax::MINUS:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    static bool boolean(const syntax& ast) {
+        switch (ast.kind) {
+            case syntax::BOOL:
+            case syntax::NOT_EQUAL:
+            case syntax::EQUAL:
+            case syntax::LESS:
+            case syntax::GREATER:
+            case syntax::LESS_EQUAL:
+            case syntax::GREATER_EQUAL:
+            case syntax::NOT:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    static bool is_int(const syntax& ast, long value) {
+        return ast.kind == syntax::INT && ast.int_value == value;
+    }
+
+    static double to_double(const syntax& ast) {
+        return ast.kind == syntax::INT ? double(ast.int_value) : ast.float_value;
+    }
+
+    void replace(syntax& ast, syntax&& with, size_t nodes_removed) {
+        auto replacement = std::move(with);  // `with` may live inside ast.
+        ast = std::move(replacement);
+        removed += nodes_removed;
+    }
+
+    bool fold_unary(syntax& ast) {
+        auto& inner = ast.inner();
+        if (ast.kind == syntax::NOT && inner.kind == syntax::BOOL)
+            replace(ast, syntax(!inner.bool_value), 1);
+        else if (ast.kind == syntax::MINUS && inner.kind == syntax::INT)
+            replace(ast, syntax(long(0ul - ulong(inner.int_value))), 1);
+        else if (ast.kind == syntax::MINUS && inner.kind == syntax::FLOAT)
+            replace(ast, syntax(-inner.float_value), 1);
+        else if (ast.kind == syntax::PLUS && number(inner))
+            replace(ast, std::move(inner), 1);
+        else
+            return false;
+        return true;
+    }
+
+    bool simplify_unary(syntax& ast) {
+        auto& inner = ast.inner();
+        if (ast.kind == syntax::PLUS && numeric(inner))
+            replace(ast, std::move(inner), 1);  // +x → x
+        else if (ast.kind == syntax::MINUS && inner.kind == syntax::MINUS && numeric(inner.inner()))
+            replace(ast, std::move(inner.inner()), 2);  // -(-x) → x
+        else if (ast.kind == syntax::NOT && inner.kind == syntax::NOT && boolean(inner.inner()))
+            replace(ast, std::move(inner.inner()), 2);  // !!b → b
+        else
+            return false;
+        return true;
+    }
+
+    bool fold_binary(syntax& ast) {
+        auto& left = ast.left();
+        auto& right = ast.right();
+
+        if (left.kind == syntax::BOOL && right.kind == syntax::BOOL) {
+            if (ast.kind == syntax::EQUAL)
+                replace(ast, syntax(left.bool_value == right.bool_value), 2);
+            else if (ast.kind == syntax::NOT_EQUAL)
+                replace(ast, syntax(left.bool_value != right.bool_value), 2);
+            else
+                return false;
+            return true;
+        }
+        if (!number(left) || !number(right))
+            return false;
+
+        if (left.kind == syntax::INT && right.kind == syntax::INT) {
+            ulong l = left.int_value, r = right.int_value;
+            switch (ast.kind) {
+                case syntax::ADDITION:       replace(ast, syntax(long(l + r)), 2); break;
+                case syntax::SUBTRACTION:    replace(ast, syntax(long(l - r)), 2); break;
+                case syntax::MULTIPLICATION: replace(ast, syntax(long(l * r)), 2); break;
+                case syntax::DIVITION:
+                    if (r == 0)
+                        return false;
+                    replace(ast, syntax(long(r == ulong(-1) ? 0 - l : ulong(long(l) / long(r)))), 2);
+                    break;
+                case syntax::LESS:           replace(ast, syntax(long(l) < long(r)), 2); break;
+                case syntax::GREATER:        replace(ast, syntax(long(l) > long(r)), 2); break;
+                case syntax::LESS_EQUAL:     replace(ast, syntax(long(l) <= long(r)), 2); break;
+                case syntax::GREATER_EQUAL:  replace(ast, syntax(long(l) >= long(r)), 2); break;
+                case syntax::NOT_EQUAL:      replace(ast, syntax(l != r), 2); break;
+                case syntax::EQUAL:          replace(ast, syntax(l == r), 2); break;
+                default: return false;
+            }
+            return true;
+        }
+
+        double l = to_double(left), r = to_double(right);
+        switch (ast.kind) {
+            case syntax::ADDITION:       replace(ast, syntax(l + r), 2); break;
+            case syntax::SUBTRACTION:    replace(ast, syntax(l - r), 2); break;
+            case syntax::MULTIPLICATION: replace(ast, syntax(l * r), 2); break;
+            case syntax::DIVITION:       replace(ast, syntax(l / r), 2); break;
+            case syntax::LESS:           replace(ast, syntax(l < r), 2); break;
+            case syntax::GREATER:        replace(ast, syntax(l > r), 2); break;
+            case syntax::LESS_EQUAL:     replace(ast, syntax(l <= r), 2); break;
+            case syntax::GREATER_EQUAL:  replace(ast, syntax(l >= r), 2); break;
+            case syntax::NOT_EQUAL:      replace(ast, syntax(l != r), 2); break;
+            case syntax::EQUAL:          replace(ast, syntax(l == r), 2); break;
+            default: return false;
+        }
+        return true;
+    }
+
+    // Only int identities are safe: x * 1.0 would turn an int x into a float.
+    bool simplify_binary(syntax& ast) {
+        auto& left = ast.left();
+        auto& right = ast.right();
+        switch (ast.kind) {
+            case syntax::ADDITION:
+                if (is_int(right, 0) && numeric(left)) { replace(ast, std::move(left), 2); return true; }
+                if (is_int(left, 0) && numeric(right)) { replace(ast, std::move(right), 2); return true; }
+                return false;
+            case syntax::SUBTRACTION:
+                if (is_int(right, 0) && numeric(left)) { replace(ast, std::move(left), 2); return true; }
+                return false;
+            case syntax::MULTIPLICATION:
+                if (is_int(right, 1) && numeric(left)) { replace(ast, std::move(left), 2); return true; }
+                if (is_int(left, 1) && numeric(right)) { replace(ast, std::move(right), 2); return true; }
+                return false;
+            case syntax::DIVITION:
+                if (is_int(right, 1) && numeric(left)) { replace(ast, std::move(left), 2); return true; }
+                return false;
+            default:
+                return false;
+        }
+    }
+};
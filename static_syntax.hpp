@@ -0,0 +1,408 @@
+#pragma once
+#include "flat_syntax.hpp"
+#include "bytecode.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Parses string literals during compilation, for the fixed expressions a
+// program embeds:
+//
+//     static constexpr auto limit = static_parser::parse("rows * 2 + 1");
+//
+// The tree is a static_syntax, which needs no heap and costs nothing at run
+// time. A syntax error is not a constant expression, so it fails the
+// compilation at the static_parser::fail() call naming the error. Called at
+// run time, the same functions throw static_parser::failure instead.
+//
+// The grammar is that of basic_parser for one statement, and the tokens
+// come from string_tokenizer, whose scanning is constexpr. Floats that need
+// more than the exact fast path to round are not constant expressions.
+template <size_t capacity>
+struct static_syntax;
+
+struct static_parser {
+    struct failure {
+        const char* title, *message;
+    };
+
+    // Parses a single statement, optionally ended by ";" or "\n". A string
+    // literal of N bytes has at most N - 1 nodes.
+    template <size_t N>
+    static constexpr static_syntax<N> parse(const char (&source)[N]);
+
+    // Not constexpr, so compilers report the call that reached it.
+    [[noreturn]] static void fail(const char* title, const char* message);
+
+private:
+    template <size_t capacity>
+    struct state;
+};
+
+void static_parser::fail(const char* title, const char* message) {
+    throw failure{title, message};
+}
+
+// The value of an expression, typed as the bytecode compiler types it.
+struct static_value {
+    bytecode::type type = bytecode::NONE;
+    long int_value = 0;
+    double float_value = 0;
+    bool bool_value = false;
+
+    constexpr static_value() {}
+    constexpr static_value(long value) : type(bytecode::INT), int_value(value) {}
+    constexpr static_value(double value) : type(bytecode::FLOAT), float_value(value) {}
+    constexpr static_value(bool value) : type(bytecode::BOOL), bool_value(value) {}
+};
+
+// The nodes of one statement in post-order, as in flat_syntax, but in arrays
+// sized at compile time. It has flat_syntax's accessors, so print() and
+// flat_syntax::convert() take it like any flat layout.
+template <size_t capacity>
+struct static_syntax {
+    using id = flat_syntax::id;
+    static constexpr id no_node = flat_syntax::no_node;
+
+    // flat_syntax::payload, with a constructor for every member, as a
+    // constant expression may only set the member it initializes.
+    union payload {
+        struct span { uint32_t offset, length; };
+
+        long   int_value;
+        double float_value;
+        bool   bool_value;
+        span   name;
+        id     type;
+
+        constexpr payload() : int_value(0) {}
+        constexpr payload(long value) : int_value(value) {}
+        constexpr payload(double value) : float_value(value) {}
+        constexpr payload(bool value) : bool_value(value) {}
+        constexpr payload(span name) : name(name) {}
+        constexpr payload(id type) : type(type) {}
+    };
+
+    const char* source = nullptr;
+    size_t count = 0;
+    uint8_t kinds[capacity] = {};
+    id left[capacity] = {}, right[capacity] = {};
+    payload values[capacity] = {};
+    id root = no_node;
+
+    constexpr size_t size() const { return count; }
+    constexpr syntax::ENUM kind(id n) const { return (syntax::ENUM)kinds[n]; }
+    constexpr id inner(id n) const { return left[n]; }
+    constexpr id var(id n) const { return left[n]; }
+    constexpr id type(id n) const { return values[n].type; }
+    constexpr id value(id n) const { return right[n]; }
+    constexpr uint32_t symbol(id n) const { return left[n]; }
+    constexpr std::string_view name(id n) const {
+        return std::string_view(source + values[n].name.offset, values[n].name.length);
+    }
+
+    constexpr id append(syntax::ENUM kind, id left, id right, payload value) {
+        assert(count < capacity);
+        kinds[count] = uint8_t(kind);
+        this->left[count] = left;
+        this->right[count] = right;
+        values[count] = value;
+        return id(count++);
+    }
+
+    // Copies the tree to the pointer representation, e.g. for the compiler.
+    syntax to_syntax() const {
+        if (root == no_node)
+            return syntax::none();
+        std::vector<syntax> converted(root + 1);
+        flat_syntax::convert(*this, 0, root, converted);
+        return std::move(converted[root]);
+    }
+
+    // Evaluates an expression as the compiler and VM would, with the value
+    // of every identifier given by variables(std::string_view name).
+    // Statements other than expressions, type errors and division by zero
+    // fail as syntax errors do.
+    template <typename F>
+    constexpr static_value evaluate(F variables) const {
+        return evaluate(root, variables);
+    }
+
+    constexpr static_value evaluate() const {
+        return evaluate([](std::string_view) -> static_value {
+            static_parser::fail("Undeclared variable!", "Identifiers need a value to be evaluated.");
+        });
+    }
+
+private:
+    static constexpr bool numeric(const static_value &value) {
+        return value.type == bytecode::INT || value.type == bytecode::FLOAT;
+    }
+
+    static constexpr double as_float(const static_value &value) {
+        return value.type == bytecode::INT ? double(value.int_value) : value.float_value;
+    }
+
+    template <typename F>
+    constexpr static_value evaluate(id n, F &variables) const {
+        switch (kind(n)) {
+            case syntax::INT: return static_value(values[n].int_value);
+            case syntax::FLOAT: return static_value(values[n].float_value);
+            case syntax::BOOL: return static_value(values[n].bool_value);
+            case syntax::IDENTIFIER: return variables(name(n));
+            case syntax::PLUS:
+            case syntax::MINUS: {
+                auto inner = evaluate(left[n], variables);
+                if (!numeric(inner))
+                    static_parser::fail("Type error!", "Unary '+' and '-' only apply to int and float values.");
+                if (kind(n) == syntax::PLUS)
+                    return inner;
+                if (inner.type == bytecode::INT)
+                    return static_value(long(0ul - ulong(inner.int_value)));
+                return static_value(-inner.float_value);
+            }
+            case syntax::NOT: {
+                auto inner = evaluate(left[n], variables);
+                if (inner.type != bytecode::BOOL)
+                    static_parser::fail("Type error!", "'!' only applies to bool values.");
+                return static_value(!inner.bool_value);
+            }
+            case syntax::ASSIGNMENT:
+            case syntax::DECLARATION:
+                static_parser::fail("Not an expression!", "Only expressions can be evaluated.");
+            default:
+                break;
+        }
+
+        auto a = evaluate(left[n], variables);
+        auto b = evaluate(right[n], variables);
+        bool equality = kind(n) == syntax::EQUAL || kind(n) == syntax::NOT_EQUAL;
+        if (a.type == bytecode::BOOL && b.type == bytecode::BOOL && equality)
+            return static_value((a.bool_value == b.bool_value) == (kind(n) == syntax::EQUAL));
+        if (!numeric(a) || !numeric(b))
+            static_parser::fail("Type error!", equality ?
+                "'==' and '!=' only compare two numbers or two bools." :
+                "Arithmetic and ordering only apply to int and float values.");
+
+        if (a.type == bytecode::INT && b.type == bytecode::INT) {
+            // Integers wrap around instead of overflowing.
+            auto x = a.int_value, y = b.int_value;
+            switch (kind(n)) {
+                case syntax::ADDITION:       return static_value(long(ulong(x) + ulong(y)));
+                case syntax::SUBTRACTION:    return static_value(long(ulong(x) - ulong(y)));
+                case syntax::MULTIPLICATION: return static_value(long(ulong(x) * ulong(y)));
+                case syntax::DIVITION:
+                    if (y == 0)
+                        static_parser::fail("Division by zero!", "An int is divided by zero.");
+                    return static_value(y == -1 ? long(0ul - ulong(x)) : x / y);
+                case syntax::LESS:           return static_value(x < y);
+                case syntax::GREATER:        return static_value(x > y);
+                case syntax::LESS_EQUAL:     return static_value(x <= y);
+                case syntax::GREATER_EQUAL:  return static_value(x >= y);
+                case syntax::NOT_EQUAL:      return static_value(x != y);
+                default:                     return static_value(x == y);
+            }
+        }
+        auto x = as_float(a), y = as_float(b);
+        switch (kind(n)) {
+            case syntax::ADDITION:       return static_value(x + y);
+            case syntax::SUBTRACTION:    return static_value(x - y);
+            case syntax::MULTIPLICATION: return static_value(x * y);
+            case syntax::DIVITION:       return static_value(x / y);
+            case syntax::LESS:           return static_value(x < y);
+            case syntax::GREATER:        return static_value(x > y);
+            case syntax::LESS_EQUAL:     return static_value(x <= y);
+            case syntax::GREATER_EQUAL:  return static_value(x >= y);
+            case syntax::NOT_EQUAL:      return static_value(x != y);
+            default:                     return static_value(x == y);
+        }
+    }
+};
+
+template <size_t capacity>
+std::ostream& operator<<(std::ostream &str, const static_syntax<capacity>& ast) {
+    print(str, ast, ast.root);
+    return str;
+}
+
+// basic_parser's recursive grammar, building a static_syntax. Nothing fails
+// quietly here, so every rule returns a node.
+template <size_t capacity>
+struct static_parser::state {
+    using id = flat_syntax::id;
+    using payload = typename static_syntax<capacity>::payload;
+    static constexpr id no_node = flat_syntax::no_node;
+
+    string_tokenizer tokenizer;
+    token current_token, next_token;
+    static_syntax<capacity> ast = {};
+
+    constexpr bool at_end() const {
+        return current_token.kind == token::END_OF_INPUT;
+    }
+
+    template <typename T>
+    constexpr bool match(T kind) const {
+        return current_token.kind == (token::ENUM)kind;
+    }
+
+    constexpr void advance() {
+        current_token = next_token;
+        next_token = tokenizer.scan();
+    }
+
+    template <typename T>
+    constexpr bool consume(T kind) {
+        if (match(kind)) {
+            advance();
+            return true;
+        }
+        return false;
+    }
+
+    constexpr id leaf(syntax::ENUM kind, payload value) {
+        return ast.append(kind, no_node, no_node, value);
+    }
+
+    constexpr id number(bool negative = false) {
+        if (match(token::INT) && (negative || current_token.int_value <= LONG_MAX)) {
+            auto value = current_token.int_value;
+            advance();
+            return leaf(syntax::INT, payload(long(negative ? 0 - value : value)));
+        }
+        if (match(token::FLOAT)) {
+            auto value = current_token.float_value;
+            advance();
+            return leaf(syntax::FLOAT, payload(negative ? -value : value));
+        }
+        fail(
+            "Number out of range!",
+            "Integers must be within [-9223372036854775808, 9223372036854775807], "
+            "and floats within the range of a double."
+        );
+    }
+
+    constexpr id identifier() {
+        if (current_token.length > syntax::max_name_length)
+            fail("Identifier too long!", "Identifiers can be at most 65535 characters long.");
+        typename payload::span name = {
+            uint32_t(current_token.position - ast.source), uint32_t(current_token.length)
+        };
+        advance();
+        return ast.append(syntax::IDENTIFIER, symbol_table::none, no_node, payload(name));
+    }
+
+    constexpr id literal() {
+        if (consume('('))
+            return group();
+        if (consume(token::TRUE))
+            return leaf(syntax::BOOL, payload(true));
+        if (consume(token::FALSE))
+            return leaf(syntax::BOOL, payload(false));
+        if (match(token::IDENTIFIER))
+            return identifier();
+        if (match(token::INT) || match(token::FLOAT) || match(token::BAD_NUMBER))
+            return number();
+        fail(
+            "Missing value!",
+            "Expected a literal value, e.g. group, identifier, number, or boolean."
+        );
+    }
+
+    constexpr id group() {
+        auto expr = expression();
+        if (!consume(')'))
+            fail("Unbalanced parenthesis!", "Expected a closing parenthesis ')'.");
+        return expr;
+    }
+
+    constexpr id unary() {
+        syntax::ENUM unary_kind = syntax::NONE;
+        if (consume('+'))
+            unary_kind = syntax::PLUS;
+        else if (consume('-'))
+            unary_kind = syntax::MINUS;
+        else if (consume('!'))
+            unary_kind = syntax::NOT;
+        else
+            return literal();
+
+        // Signed numbers are folded into the literal, as are numbers alone
+        // in a group, as in -(3).
+        auto number_ahead = next_token.kind == token::INT || next_token.kind == token::FLOAT;
+        auto grouped = unary_kind != syntax::NOT && match('(') && number_ahead;
+        if (grouped)
+            advance();
+        if (unary_kind != syntax::NOT && (match(token::INT) || match(token::FLOAT)) && (!grouped || next_token.kind == (token::ENUM)')')) {
+            auto num = number(unary_kind == syntax::MINUS);
+            if (grouped)
+                advance();
+            return num;
+        }
+
+        auto inner = grouped ? group() : literal();
+        return ast.append(unary_kind, inner, no_node, payload());
+    }
+
+    constexpr id binary(unsigned min_power) {
+        auto expr = unary();
+        for (;;) {
+            auto& op = binary_operators::find(current_token.kind);
+            if (op.power == 0 || op.power < min_power)
+                return expr;
+            advance();
+            if (!op.unary_operand && (match('+') || match('-') || match('!')))
+                fail(
+                    "Invalid syntax!",
+                    "Unary operators must be surrounded by '(' and ')' when "
+                    "used on the right of a binary expression."
+                );
+            auto right = binary(op.right_associative ? op.power : op.power + 1);
+            expr = ast.append(op.kind, expr, right, payload());
+        }
+    }
+
+    constexpr id expression() {
+        return binary(1);
+    }
+
+    constexpr id statement() {
+        id stmt = no_node;
+        if (match(token::IDENTIFIER) && next_token.kind == token::EQUAL) {
+            auto var = identifier();
+            advance();
+            auto expr = expression();
+            stmt = ast.append(syntax::ASSIGNMENT, var, expr, payload());
+        } else if (match(token::IDENTIFIER) && next_token.kind == token::COLON) {
+            auto var = identifier();
+            advance();
+            auto type = match(token::IDENTIFIER) ? identifier() : no_node;
+            auto expr = consume('=') ? expression() : no_node;
+            if (type == no_node && expr == no_node)
+                fail(
+                    "Malformed variable declaration!",
+                    "You must declare a variable with either a type or an expression."
+                );
+            stmt = ast.append(syntax::DECLARATION, var, expr, payload(type));
+        } else
+            stmt = expression();
+
+        if (!consume('\n'))
+            consume(';');
+        if (!at_end())
+            fail("Missing end of statement!", "A static syntax holds a single statement.");
+        return stmt;
+    }
+};
+
+template <size_t N>
+constexpr static_syntax<N> static_parser::parse(const char (&source)[N]) {
+    auto tokenizer = string_tokenizer::from_range(source, source + N - 1);
+    auto first = tokenizer.scan();
+    auto second = tokenizer.scan();
+    state<N> parser{tokenizer, first, second};
+    parser.ast.source = source;
+    parser.ast.root = parser.statement();
+    return parser.ast;
+}
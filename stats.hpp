@@ -0,0 +1,104 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Build with -DPARSER_STATS=1 to count where tokenizing, parsing and
+// printing spend their time and memory. Otherwise every hook below is empty
+// and compiles away.
+#ifndef PARSER_STATS
+#define PARSER_STATS 0
+#endif
+
+// Counters kept per thread, so threads never contend on them; a
+// parallel_parser's workers each count into their own.
+struct parser_stats {
+    static constexpr bool enabled = PARSER_STATS;
+
+    uint64_t tokens[256] = {};     // By token::ENUM
+    uint64_t nodes[32] = {};       // By syntax::ENUM, for syntax and flat_syntax
+    uint64_t allocations = 0;      // For syntax nodes: one per node, or one per block of their arena
+    uint64_t allocated_bytes = 0;
+    unsigned max_depth = 0;        // The deepest nesting of groups parsed
+    uint64_t errors = 0;           // Failed statements
+    uint64_t tokenize_ns = 0;
+    uint64_t parse_ns = 0;         // Not counting the tokenizing done while parsing
+    uint64_t print_ns = 0;
+
+    static parser_stats& current() {
+        static thread_local parser_stats stats;
+        return stats;
+    }
+
+    void reset() { *this = parser_stats(); }
+
+    static void token(unsigned kind) {
+        if constexpr (enabled)
+            ++current().tokens[kind & 255];
+    }
+
+    static void node(unsigned kind) {
+        if constexpr (enabled)
+            ++current().nodes[kind & 31];
+    }
+
+    static void allocation(size_t bytes) {
+        if constexpr (enabled) {
+            ++current().allocations;
+            current().allocated_bytes += bytes;
+        }
+    }
+
+    static void depth(unsigned depth) {
+        if constexpr (enabled)
+            if (depth > current().max_depth)
+                current().max_depth = depth;
+    }
+
+    static void error() {
+        if constexpr (enabled)
+            ++current().errors;
+    }
+
+    // Adds the time until it goes out of scope to one of the totals, less
+    // the time of phases nested in it, so the tokenizing done while parsing
+    // only counts as tokenizing.
+    struct phase {
+        uint64_t* total = nullptr;
+        phase* outer = nullptr;
+        uint64_t start = 0, nested = 0;
+
+        phase(uint64_t parser_stats::*which) {
+            if constexpr (enabled) {
+                total = &(current().*which);
+                outer = innermost();
+                innermost() = this;
+                start = now();
+            }
+        }
+
+        ~phase() {
+            if constexpr (enabled) {
+                auto elapsed = now() - start;
+                *total += elapsed - nested;
+                if (outer)
+                    outer->nested += elapsed;
+                innermost() = outer;
+            }
+        }
+
+        phase(const phase&) = delete;
+        phase& operator=(const phase&) = delete;
+
+    private:
+        static phase*& innermost() {
+            static thread_local phase* active = nullptr;
+            return active;
+        }
+
+        static uint64_t now() {
+            using namespace std::chrono;
+            return uint64_t(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+        }
+    };
+};
@@ -0,0 +1,109 @@
+#pragma once
+#include "parser.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+// Parses input from a file descriptor, such as a pipe, as it arrives, in
+// fixed-size chunks. Each chunk is parsed up to its last statement end and
+// the rest, a statement still being read, is carried over to the front of
+// the buffer for the next chunk. Memory therefore stays bounded by the
+// chunk size and the longest statement, however long the input.
+//
+// As in parallel_parser, any ";" or "\n" is a safe place to cut, so tokens
+// and statements that straddle chunks are parsed exactly as parse_program
+// would parse the whole input.
+struct stream_parser {
+    size_t chunk_size = 1 << 16;
+    symbol_table* symbols = nullptr;
+    simplifier* simplify = nullptr;
+    bool iterative = false;
+    unsigned max_depth = 1000;
+
+    size_t statements = 0;   // Handed to the callback so far
+    size_t bytes_read = 0;
+
+    // Reads fd to its end, calling on_statement(syntax&) for every statement
+    // in order, with none in place of a statement that failed and was
+    // reported. Identifiers point into the buffer, so a statement is only
+    // valid until the callback returns. Throws std::system_error if a read
+    // fails.
+    template <typename F>
+    void parse(int fd, F on_statement);
+
+private:
+    std::vector<char> buffer;
+    std::shared_ptr<arena> nodes = std::make_shared<arena>();
+    char cut_at = 0;  // The ";" or "\n" the previous chunk was cut after
+
+    template <typename F>
+    void parse_range(const char* begin, const char* end, F &on_statement) {
+        auto parser = parser::from_range(begin, end, nodes, symbols);
+        // Errors at the start of the chunk name the token before them just
+        // as they would without the cut.
+        if (cut_at)
+            parser.previous_token = token(begin, cut_at);
+        parser.simplify = simplify;
+        parser.iterative = iterative;
+        parser.max_depth = max_depth;
+        for (auto& statement : parser.parse_program()) {
+            ++statements;
+            on_statement(statement);
+        }
+        nodes->reset();
+    }
+
+    // The end of the last complete statement in [begin, end), preferring a
+    // line end so reports show whole lines, or begin if there is none.
+    static const char* last_statement_end(const char* begin, const char* end) {
+        auto semicolon = begin;
+        for (auto cut = end; cut > begin; --cut) {
+            if (cut[-1] == '\n')
+                return cut;
+            if (cut[-1] == ';' && semicolon == begin)
+                semicolon = cut;
+        }
+        return semicolon;
+    }
+};
+
+template <typename F>
+void stream_parser::parse(int fd, F on_statement) {
+    size_t used = 0;  // Bytes in the buffer, all of them an unfinished statement
+    cut_at = 0;
+    for (;;) {
+        if (buffer.size() < used + chunk_size)
+            buffer.resize(used + chunk_size);
+
+        auto result = ::read(fd, buffer.data() + used, chunk_size);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result < 0)
+            throw std::system_error(errno, std::generic_category(), "read");
+        if (result == 0)
+            break;
+        bytes_read += size_t(result);
+
+        auto begin = buffer.data();
+        auto end = begin + used + size_t(result);
+        auto cut = last_statement_end(begin + used, end);
+        if (cut == begin + used) {
+            // No statement ends in this chunk, so it all belongs to the
+            // unfinished one, and the buffer grows to hold it.
+            used = size_t(end - begin);
+            continue;
+        }
+        parse_range(begin, cut, on_statement);
+        cut_at = cut[-1];
+        used = size_t(end - cut);
+        std::memmove(begin, cut, used);
+    }
+
+    if (used)
+        parse_range(buffer.data(), buffer.data() + used, on_statement);
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "arena.hpp"
+#include "hash.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+// Interns identifiers as dense 32-bit symbol ids, so that comparing names or
+// looking up variables is an integer compare or an index. Names are copied,
+// so symbols outlive the source they were first seen in.
+struct symbol_table {
+    static constexpr uint32_t none = UINT32_MAX;
+
+    std::vector<std::string_view> names;  // Indexed by symbol
+
+    symbol_table() : buckets(64, none) {}
+
+    uint32_t intern(const char* name, size_t length) {
+        auto hashed = hash(name, length);
+        auto mask = buckets.size() - 1;
+        for (auto bucket = hashed & mask;; bucket = (bucket + 1) & mask) {
+            auto symbol = buckets[bucket];
+            if (symbol == none)
+                return insert(bucket, name, length);
+            if (names[symbol].size() == length && std::memcmp(names[symbol].data(), name, length) == 0)
+                return symbol;
+        }
+    }
+
+    uint32_t intern(std::string_view name) {
+        return intern(name.data(), name.size());
+    }
+
+    // Returns none if the name has not been interned.
+    uint32_t find(std::string_view name) const {
+        auto mask = buckets.size() - 1;
+        for (auto bucket = hash(name.data(), name.size()) & mask;; bucket = (bucket + 1) & mask) {
+            auto symbol = buckets[bucket];
+            if (symbol == none || names[symbol] == name)
+                return symbol;
+        }
+    }
+
+    std::string_view name(uint32_t symbol) const {
+        return names[symbol];
+    }
+
+    size_t size() const {
+        return names.size();
+    }
+
+private:
+    std::vector<uint32_t> buckets;  // Open addressing, at most half full
+    arena storage;
+
+    static uint64_t hash(const char* name, size_t length) {
+        return hash_bytes(name, length);
+    }
+
+    uint32_t insert(size_t bucket, const char* name, size_t length) {
+        auto copy = (char*)storage.allocate(length ? length : 1, 1);
+        std::memcpy(copy, name, length);
+        auto symbol = uint32_t(names.size());
+        names.push_back(std::string_view(copy, length));
+        buckets[bucket] = symbol;
+
+        if (names.size() * 2 > buckets.size())
+            rehash();
+        return symbol;
+    }
+
+    void rehash() {
+        std::vector<uint32_t> grown(buckets.size() * 2, none);
+        auto mask = grown.size() - 1;
+        for (uint32_t symbol = 0; symbol < names.size(); ++symbol) {
+            auto bucket = hash(names[symbol].data(), names[symbol].size()) & mask;
+            while (grown[bucket] != none)
+                bucket = (bucket + 1) & mask;
+            grown[bucket] = symbol;
+        }
+        buckets = std::move(grown);
+    }
+};
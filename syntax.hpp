@@ -1,10 +1,21 @@
 #pragma once
+#include "arena.hpp"
+#include "stats.hpp"
+#include "symbols.hpp"
+
+#include <cassert>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <vector>
 
+// A node is 16 bytes: the kind and flags, then a payload that is either a
+// leaf's value, inline, or a pointer to the children of an interior node.
+// Only interior nodes are allocated, and a node moves by copying its bytes.
 struct syntax {
-    enum ENUM {
+    enum ENUM : uint8_t {
         NONE,
         FAILED,
         DECLARATION,
@@ -19,16 +30,28 @@ struct syntax {
         IDENTIFIER, INT, FLOAT, BOOL
     } kind = NONE;
 
+    using allocator = arena;
+
+    // Set when the node's children live in an arena. Pooled nodes are never
+    // deleted one by one; the arena drops them all at once.
+    bool pooled = false;
+
+    // IDENTIFIER: the length of the name and its interned symbol, if any.
+    uint16_t name_length = 0;
+    uint32_t symbol = symbol_table::none;
+
+    static constexpr size_t max_name_length = UINT16_MAX;
+
     struct declaration_t;
     struct binary_t;
     struct unary_t;
-    struct identifier_t;
 
+    // Moves copy the node's bytes, so every member must stay trivially copyable.
     union {
         struct declaration_t *declaration;
         struct binary_t *binary;
         struct unary_t *unary;
-        struct identifier_t *id;
+        const char* name;  // IDENTIFIER, into the source
         long   int_value;
         double float_value;
         bool   bool_value;
@@ -53,7 +76,7 @@ struct syntax {
     syntax(ENUM kind, syntax&& inner);
     syntax(ENUM kind, syntax&& left, syntax&& right);
     syntax(syntax&& var, syntax&& type, syntax&& value);
-    syntax(const char* position, int length);
+    syntax(const char* position, int length, uint32_t symbol = symbol_table::none);
     syntax(long value);
     syntax(double value);
     syntax(bool value);
@@ -61,16 +84,40 @@ struct syntax {
     static syntax fail();
     static syntax none();
 
-    bool is_none();
-    bool failed();
+    bool is_none() const;
+    bool failed() const;
+    bool has_children() const;
+    std::string_view identifier() const;
 
     ~syntax();
+
+private:
+    template <typename T, typename... Args>
+    T* make(Args&&... args);
 };
 
 struct syntax::unary_t {syntax inner;};
 struct syntax::binary_t {syntax left, right;};
 struct syntax::declaration_t {syntax var, type, value;};
-struct syntax::identifier_t {const char* name; int length;};
+
+static_assert(sizeof(syntax) == 16, "Syntax nodes should stay two words.");
+static_assert(std::is_standard_layout_v<syntax>, "Syntax nodes are moved with memcpy.");
+
+template <typename T, typename... Args>
+T* syntax::make(Args&&... args) {
+    if (auto nodes = arena::active) {
+        pooled = true;
+        // Counted a block at a time, and only for the arena of the nodes,
+        // not those of the symbol table or shared subtrees.
+        auto last = nodes->head;
+        auto made = nodes->make<T>(std::forward<Args>(args)...);
+        if (nodes->head != last)
+            parser_stats::allocation(sizeof(arena::block) + nodes->head->size);
+        return made;
+    }
+    parser_stats::allocation(sizeof(T));
+    return new T{std::forward<Args>(args)...};
+}
 
 const syntax& syntax::inner() const { return unary->inner; }
 const syntax& syntax::left()  const { return binary->left; }
@@ -86,110 +133,63 @@ syntax& syntax::var()   { return declaration->var; }
 syntax& syntax::type()  { return declaration->type; }
 syntax& syntax::value() { return declaration->value; }
 
+// Whatever the kind, the node is its bytes: the payload is a value or a
+// pointer that changes owner, and the moved-from node is left owning nothing.
 syntax::syntax(syntax&& other) {
-    switch (other.kind) {
-        case DECLARATION:
-            declaration = other.declaration; break;
-        case ADDITION:
-        case SUBTRACTION:
-        case MULTIPLICATION:
-        case DIVITION:
-        case NOT_EQUAL:
-        case EQUAL:
-        case LESS:
-        case GREATER:
-        case LESS_EQUAL:
-        case GREATER_EQUAL:
-        case ASSIGNMENT:
-            binary = other.binary; break;
-        case PLUS:
-        case MINUS:
-        case NOT:
-            unary = other.unary; break;
-        case IDENTIFIER:
-            id = other.id; break;
-        case INT:
-            int_value = other.int_value; break;
-        case FLOAT:
-            float_value = other.float_value; break;
-        case BOOL:
-            bool_value = other.bool_value; break;
-    };
-    kind = other.kind;
+    std::memcpy((void*)this, (const void*)&other, sizeof(syntax));
     other.kind = FAILED;
 }
 
 syntax& syntax::operator=(syntax&& other) {
-    switch (other.kind) {
-        case DECLARATION:
-            declaration = other.declaration; break;
-        case ADDITION:
-        case SUBTRACTION:
-        case MULTIPLICATION:
-        case DIVITION:
-        case NOT_EQUAL:
-        case EQUAL:
-        case LESS:
-        case GREATER:
-        case LESS_EQUAL:
-        case GREATER_EQUAL:
-        case ASSIGNMENT:
-            binary = other.binary; break;
-        case PLUS:
-        case MINUS:
-        case NOT:
-            unary = other.unary; break;
-        case IDENTIFIER:
-            id = other.id; break;
-        case INT:
-            int_value = other.int_value; break;
-        case FLOAT:
-            float_value = other.float_value; break;
-        case BOOL:
-            bool_value = other.bool_value; break;
-    };
-    kind = other.kind;
+    if (this == &other)
+        return *this;
+    this->~syntax();  // Release whatever this node held before.
+    std::memcpy((void*)this, (const void*)&other, sizeof(syntax));
     other.kind = FAILED;
     return *this;
 }
 
 syntax::syntax(ENUM kind, syntax&& inner) {
+    parser_stats::node(kind);
     this->kind = kind;
-    unary = new unary_t;
-    std::swap(unary->inner, inner);
+    unary = make<unary_t>(std::move(inner));
 }
 
 syntax::syntax(ENUM kind, syntax&& left, syntax&& right) {
+    parser_stats::node(kind);
     this->kind = kind;
-    binary = new binary_t;
-    std::swap(binary->left, left);
-    std::swap(binary->right, right);
+    binary = make<binary_t>(std::move(left), std::move(right));
 }
 
 syntax::syntax(syntax&& var, syntax&& type, syntax&& value) {
+    parser_stats::node(DECLARATION);
     kind = DECLARATION;
-    declaration = new declaration_t;
-    std::swap(declaration->var, var);
-    std::swap(declaration->type, type);
-    std::swap(declaration->value, value);
+    declaration = make<declaration_t>(std::move(var), std::move(type), std::move(value));
 }
 
-syntax::syntax(const char* position, int length) {
+syntax::syntax(const char* position, int length, uint32_t symbol) {
+    parser_stats::node(IDENTIFIER);
+    assert(size_t(length) <= max_name_length);
     kind = IDENTIFIER;
-    id = new identifier_t{position, length};
+    name = position;
+    name_length = uint16_t(length);
+    this->symbol = symbol;
 }
 
 syntax::syntax(long value) {
+    parser_stats::node(INT);
     kind = INT;
     int_value = value;
 }
 
 syntax::syntax(double value) {
+    parser_stats::node(FLOAT);
     kind = FLOAT;
     float_value = value;
 }
 
 syntax::syntax(bool value) {
+    parser_stats::node(BOOL);
     kind = BOOL;
     bool_value = value;
 }
@@ -208,85 +208,69 @@ syntax syntax::none() {
     return none;
 }
 
-bool syntax::is_none() {
+bool syntax::is_none() const {
     return kind == syntax::NONE;
 }
 
-bool syntax::failed() {
+bool syntax::failed() const {
     return kind == syntax::FAILED;
 }
 
+bool syntax::has_children() const {
+    return kind >= DECLARATION && kind <= NOT;
+}
+
+std::string_view syntax::identifier() const {
+    return std::string_view(name, name_length);
+}
+
 
+// Children that have children of their own are moved onto a stack before
+// their parent is deleted, and the outermost destructor frees them in a
+// loop, so trees of any depth are freed without recursion.
 syntax::~syntax() {
+    if (pooled) {
+        kind = FAILED;
+        return;
+    }
+    if (!has_children()) {
+        kind = FAILED;
+        return;
+    }
+
+    static thread_local std::vector<syntax> orphans;
+    static thread_local bool freeing = false;
+    auto adopt = [](syntax &child) {
+        if (child.has_children() && !child.pooled)
+            orphans.push_back(std::move(child));
+    };
     switch (kind) {
         case DECLARATION:
+            adopt(declaration->var);
+            adopt(declaration->type);
+            adopt(declaration->value);
             delete declaration; break;
-        case ADDITION:
-        case SUBTRACTION:
-        case MULTIPLICATION:
-        case DIVITION:
-        case NOT_EQUAL:
-        case EQUAL:
-        case LESS:
-        case GREATER:
-        case LESS_EQUAL:
-        case GREATER_EQUAL:
-        case ASSIGNMENT:
-            delete binary; break;
         case PLUS:
         case MINUS:
         case NOT:
+            adopt(unary->inner);
             delete unary; break;
-        case IDENTIFIER:
-            delete id; break;
+        default:
+            adopt(binary->left);
+            adopt(binary->right);
+            delete binary; break;
     };
     kind = FAILED;
-}
 
-std::ostream& operator<<(std::ostream &str, const syntax& ast) {
-    switch (ast.kind) {
-        case syntax::DECLARATION:
-            str << "(" << ast.var() << ": " << ast.type() << " = " << ast.value() << ")"; break;
-        case syntax::ADDITION:
-            str << "(" << ast.left() << " + " << ast.right() << ")"; break;
-        case syntax::SUBTRACTION:
-            str << "(" << ast.left() << " - " << ast.right() << ")"; break;
-        case syntax::MULTIPLICATION:
-            str << "(" << ast.left() << " * " << ast.right() << ")"; break;
-        case syntax::DIVITION:
-            str << "(" << ast.left() << " / " << ast.right() << ")"; break;
-        case syntax::NOT_EQUAL:
-            str << "(" << ast.left() << " != " << ast.right() << ")"; break;
-        case syntax::EQUAL:
-            str << "(" << ast.left() << " == " << ast.right() << ")"; break;
-        case syntax::LESS:
-            str << "(" << ast.left() << " < " << ast.right() << ")"; break;
-        case syntax::GREATER:
-            str << "(" << ast.left() << " > " << ast.right() << ")"; break;
-        case syntax::LESS_EQUAL:
-            str << "(" << ast.left() << " <= " << ast.right() << ")"; break;
-        case syntax::GREATER_EQUAL:
-            str << "(" << ast.left() << " >= " << ast.right() << ")"; break;
-        case syntax::ASSIGNMENT:
-            str << "(" << ast.left() << " = " << ast.right() << ")"; break;
-        case syntax::PLUS:
-            str << "(+ " << ast.inner() << ")"; break;
-        case syntax::MINUS:
-            str << "(- " << ast.inner() << ")"; break;
-        case syntax::NOT:
-            str << "(! " << ast.inner() << ")"; break;
-        case syntax::IDENTIFIER:
-            str << "'" << std::string_view(ast.id->name, ast.id->length) << "'id"; break;
-        case syntax::INT:
-            str << ast.int_value << "i"; break;
-        case syntax::FLOAT:
-            str << ast.float_value << "f"; break;
-        case syntax::BOOL:
-            str << (ast.bool_value ? "true" : "false"); break;
-        case syntax::FAILED:
-            str << "failed"; break;
-        case syntax::NONE:
-            str << "none"; break;
+    if (freeing)
+        return;
+    freeing = true;
+    while (!orphans.empty()) {
+        auto orphan = std::move(orphans.back());
+        orphans.pop_back();
     }
-    return str;
+    freeing = false;
 }
+
+// operator<< prints through syntax_printer, which needs the definitions above.
+#include "printer.hpp"
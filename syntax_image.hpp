@@ -0,0 +1,400 @@
+#pragma once
+#include "flat_syntax.hpp"
+#include "hash.hpp"
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// A parsed program saved in a binary format that is used in place once
+// loaded. After a header come the nodes in the post-order layout of
+// flat_syntax, each array aligned for direct access:
+//
+//   header
+//   payload values[nodes]        8 bytes each
+//   id      left[nodes], right[nodes]
+//   id      statements[statements]  roots, no_node for failed statements
+//   uint8_t kinds[nodes]
+//   char    names[names_size]    every distinct identifier name, once
+//
+// Identifiers name a span of names, and their symbol is the position of
+// that name among the distinct names. The header carries the size and hash
+// of the source and the parse options the syntax depends on, so a stale
+// image can be detected without parsing. Only programs without errors are
+// saved, so an image never hides an error report. Loading maps the file and
+// validates it in one scan; nothing is rebuilt.
+struct syntax_image {
+    using id = flat_syntax::id;
+    using payload = flat_syntax::payload;
+    static constexpr id no_node = flat_syntax::no_node;
+
+    static constexpr char magic[8] = {'R', 'D', 'A', 'S', 'T', 'I', 'M', 'G'};
+    static constexpr uint32_t version = 2;
+    static constexpr uint32_t byte_order = 0x01020304;
+
+    struct header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;  // Images are only read on machines of the same byte order.
+        uint32_t nodes;
+        uint32_t statements;
+        uint32_t names_size;
+        uint32_t simplified;  // Parse options, see options
+        uint32_t max_depth;
+        uint32_t reserved;
+        uint64_t source_size;
+        uint64_t source_hash;
+    };
+
+    // The options of the parse an image was saved from. Other options may
+    // parse the same source differently, e.g. a shallower max_depth.
+    struct options {
+        bool simplified = false;
+        unsigned max_depth = 1000;
+    };
+
+    const header* head = nullptr;
+    const payload* values = nullptr;
+    const id* left = nullptr;
+    const id* right = nullptr;
+    const id* roots = nullptr;
+    const uint8_t* kinds = nullptr;
+    const char* names = nullptr;
+
+    mapped_file file;  // Set when the image was opened from a file.
+
+    static std::string serialize(const std::vector<syntax> &statements, const char* source, const char* source_end, const options &parsed);
+    static void save(const std::string &path, const std::string &image);
+
+    // Views an image in memory, which must stay alive and 8 byte aligned.
+    // Throws std::runtime_error if it is not a valid image.
+    static syntax_image view(const char* data, size_t size);
+    static syntax_image open(const std::string &path);
+
+    // Whether the image was saved from exactly this source, parsed with the
+    // same options.
+    bool matches(const char* source, const char* source_end, const options &parsed) const {
+        auto size = size_t(source_end - source);
+        return head->simplified == parsed.simplified && head->max_depth == parsed.max_depth
+            && head->source_size == size && head->source_hash == hash_bytes(source, size);
+    }
+
+    size_t size() const { return head->nodes; }
+    size_t statements() const { return head->statements; }
+    id statement(size_t i) const { return roots[i]; }
+
+    syntax::ENUM kind(id n) const { return (syntax::ENUM)kinds[n]; }
+    id inner(id n) const { return left[n]; }
+    id var(id n) const { return left[n]; }
+    id type(id n) const { return values[n].type; }
+    id value(id n) const { return right[n]; }
+    uint32_t symbol(id n) const { return left[n]; }
+    std::string_view name(id n) const {
+        return std::string_view(names + values[n].name.offset, values[n].name.length);
+    }
+
+    // The statements as `syntax`, whose identifiers point into the image.
+    std::vector<syntax> to_syntax() const;
+
+private:
+    struct writer;
+
+    static void validate(const syntax_image &image);
+};
+
+// Appends a syntax tree to the arrays of an image in post-order. The tree is
+// walked with an explicit stack, so no tree is too deep to save.
+struct syntax_image::writer {
+    std::vector<payload> values;
+    std::vector<id> left, right;
+    std::vector<uint8_t> kinds;
+    std::string names;
+    std::vector<uint32_t> name_offsets;  // Indexed by symbol
+    symbol_table symbols;
+
+    // A node still to be written, and whether its operands are pushed.
+    struct frame {
+        const syntax* node;
+        bool expanded;
+    };
+    std::vector<frame> pending;
+    std::vector<id> done;  // Ids of the operands written so far
+
+    id append(syntax::ENUM kind, id l, id r, payload value) {
+        kinds.push_back(kind);
+        left.push_back(l);
+        right.push_back(r);
+        values.push_back(value);
+        return id(kinds.size() - 1);
+    }
+
+    id write(const syntax &ast) {
+        pending.push_back({&ast, false});
+        while (!pending.empty()) {
+            auto& top = pending.back();
+            auto& node = *top.node;
+            if (node.has_children() && !top.expanded) {
+                top.expanded = true;  // Before expand() may move top.
+                expand(node);
+                continue;
+            }
+            pending.pop_back();
+            done.push_back(leave(node));
+        }
+        auto written = done.back();
+        done.pop_back();
+        return written;
+    }
+
+private:
+    // Pushes the operands of a node in reverse, so they are written in order.
+    void expand(const syntax &ast) {
+        switch (ast.kind) {
+            case syntax::DECLARATION:
+                pending.push_back({&ast.value(), false});
+                pending.push_back({&ast.type(), false});
+                pending.push_back({&ast.var(), false});
+                break;
+            case syntax::ADDITION:
+            case syntax::SUBTRACTION:
+            case syntax::MULTIPLICATION:
+            case syntax::DIVITION:
+            case syntax::NOT_EQUAL:
+            case syntax::EQUAL:
+            case syntax::LESS:
+            case syntax::GREATER:
+            case syntax::LESS_EQUAL:
+            case syntax::GREATER_EQUAL:
+            case syntax::ASSIGNMENT:
+                pending.push_back({&ast.right(), false});
+                pending.push_back({&ast.left(), false});
+                break;
+            case syntax::PLUS:
+            case syntax::MINUS:
+            case syntax::NOT:
+                pending.push_back({&ast.inner(), false});
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Appends a node whose operands are the last ids in done, replacing
+    // them. Absent nodes are no_node and append nothing.
+    id leave(const syntax &ast) {
+        payload value;
+        value.int_value = 0;
+        switch (ast.kind) {
+            case syntax::DECLARATION: {
+                auto operands = done.data() + done.size() - 3;
+                value.type = operands[1];
+                auto var = operands[0], assigned = operands[2];
+                done.resize(done.size() - 3);
+                return append(ast.kind, var, assigned, value);
+            }
+            case syntax::ADDITION:
+            case syntax::SUBTRACTION:
+            case syntax::MULTIPLICATION:
+            case syntax::DIVITION:
+            case syntax::NOT_EQUAL:
+            case syntax::EQUAL:
+            case syntax::LESS:
+            case syntax::GREATER:
+            case syntax::LESS_EQUAL:
+            case syntax::GREATER_EQUAL:
+            case syntax::ASSIGNMENT: {
+                auto l = done[done.size() - 2], r = done.back();
+                done.resize(done.size() - 2);
+                return append(ast.kind, l, r, value);
+            }
+            case syntax::PLUS:
+            case syntax::MINUS:
+            case syntax::NOT: {
+                auto inner = done.back();
+                done.pop_back();
+                return append(ast.kind, inner, no_node, value);
+            }
+            case syntax::IDENTIFIER: {
+                auto symbol = symbols.intern(ast.name, ast.name_length);
+                if (symbol == name_offsets.size()) {
+                    name_offsets.push_back(uint32_t(names.size()));
+                    names.append(ast.name, ast.name_length);
+                }
+                value.name = {name_offsets[symbol], uint32_t(ast.name_length)};
+                return append(ast.kind, symbol, no_node, value);
+            }
+            case syntax::INT:
+                value.int_value = ast.int_value;
+                return append(ast.kind, no_node, no_node, value);
+            case syntax::FLOAT:
+                value.float_value = ast.float_value;
+                return append(ast.kind, no_node, no_node, value);
+            case syntax::BOOL:
+                value.bool_value = ast.bool_value;
+                return append(ast.kind, no_node, no_node, value);
+            default:
+                return no_node;
+        }
+    }
+};
+
+std::string syntax_image::serialize(const std::vector<syntax> &statements, const char* source, const char* source_end, const options &parsed) {
+    writer nodes;
+    std::vector<id> roots;
+    roots.reserve(statements.size());
+    for (auto& statement : statements)
+        roots.push_back(nodes.write(statement));
+
+    header head = {};
+    std::memcpy(head.magic, magic, sizeof magic);
+    head.version = version;
+    head.byte_order = byte_order;
+    head.nodes = uint32_t(nodes.kinds.size());
+    head.statements = uint32_t(roots.size());
+    head.names_size = uint32_t(nodes.names.size());
+    head.simplified = parsed.simplified;
+    head.max_depth = parsed.max_depth;
+    head.source_size = uint64_t(source_end - source);
+    head.source_hash = hash_bytes(source, size_t(source_end - source));
+
+    auto put = [](std::string &image, const void* data, size_t size) {
+        image.append((const char*)data, size);
+    };
+    std::string image;
+    image.reserve(sizeof head + nodes.kinds.size() * 17 + roots.size() * 4 + nodes.names.size() + 8);
+    put(image, &head, sizeof head);
+    put(image, nodes.values.data(), nodes.values.size() * sizeof(payload));
+    put(image, nodes.left.data(), nodes.left.size() * sizeof(id));
+    put(image, nodes.right.data(), nodes.right.size() * sizeof(id));
+    put(image, roots.data(), roots.size() * sizeof(id));
+    put(image, nodes.kinds.data(), nodes.kinds.size());
+    put(image, nodes.names.data(), nodes.names.size());
+    return image;
+}
+
+void syntax_image::save(const std::string &path, const std::string &image) {
+    auto file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        throw std::system_error(errno, std::generic_category(), path);
+    bool written = std::fwrite(image.data(), 1, image.size(), file) == image.size();
+    int error = errno;
+    written &= std::fclose(file) == 0;
+    if (!written)
+        throw std::system_error(error ? error : errno, std::generic_category(), path);
+}
+
+syntax_image syntax_image::view(const char* data, size_t size) {
+    if (size < sizeof(header) || (size_t)data % alignof(payload) != 0)
+        throw std::runtime_error("Not a syntax image: too small or misaligned.");
+
+    syntax_image image;
+    image.head = (const header*)data;
+    auto& head = *image.head;
+    if (std::memcmp(head.magic, magic, sizeof magic) != 0)
+        throw std::runtime_error("Not a syntax image.");
+    if (head.version != version)
+        throw std::runtime_error("Unsupported syntax image version.");
+    if (head.byte_order != byte_order)
+        throw std::runtime_error("Syntax image saved with another byte order.");
+
+    size_t offset = sizeof(header);
+    image.values = (const payload*)(data + offset);
+    offset += size_t(head.nodes) * sizeof(payload);
+    image.left = (const id*)(data + offset);
+    offset += size_t(head.nodes) * sizeof(id);
+    image.right = (const id*)(data + offset);
+    offset += size_t(head.nodes) * sizeof(id);
+    image.roots = (const id*)(data + offset);
+    offset += size_t(head.statements) * sizeof(id);
+    image.kinds = (const uint8_t*)(data + offset);
+    offset += head.nodes;
+    image.names = data + offset;
+    offset += head.names_size;
+    if (offset != size)
+        throw std::runtime_error("Syntax image has the wrong size.");
+
+    validate(image);
+    return image;
+}
+
+// Checks that every node is well formed and only refers to nodes before
+// it, so nothing read from the image can go out of bounds or loop.
+void syntax_image::validate(const syntax_image &image) {
+    auto nodes = image.head->nodes;
+    auto names_size = image.head->names_size;
+    auto before = [](id operand, id n) { return operand < n; };
+    auto optional = [](id operand, id n) { return operand == no_node || operand < n; };
+
+    for (id n = 0; n < nodes; ++n) {
+        bool valid = false;
+        switch (image.kind(n)) {
+            case syntax::DECLARATION:
+                valid = before(image.var(n), n) && optional(image.type(n), n) && optional(image.value(n), n);
+                break;
+            case syntax::ADDITION:
+            case syntax::SUBTRACTION:
+            case syntax::MULTIPLICATION:
+            case syntax::DIVITION:
+            case syntax::NOT_EQUAL:
+            case syntax::EQUAL:
+            case syntax::LESS:
+            case syntax::GREATER:
+            case syntax::LESS_EQUAL:
+            case syntax::GREATER_EQUAL:
+            case syntax::ASSIGNMENT:
+                valid = before(image.left[n], n) && before(image.right[n], n);
+                break;
+            case syntax::PLUS:
+            case syntax::MINUS:
+            case syntax::NOT:
+                valid = before(image.inner(n), n);
+                break;
+            case syntax::IDENTIFIER: {
+                auto name = image.values[n].name;
+                valid = name.offset <= names_size && name.length <= names_size - name.offset
+                    && name.length <= syntax::max_name_length;
+                break;
+            }
+            case syntax::INT:
+            case syntax::FLOAT:
+                valid = true;
+                break;
+            case syntax::BOOL:
+                // Saved with the rest of the payload zeroed.
+                valid = image.values[n].int_value == 0 || image.values[n].int_value == 1;
+                break;
+            default:
+                break;
+        }
+        if (!valid)
+            throw std::runtime_error("Syntax image has a malformed node.");
+    }
+
+    for (size_t i = 0; i < image.statements(); ++i)
+        if (!optional(image.statement(i), nodes))
+            throw std::runtime_error("Syntax image has a malformed statement.");
+}
+
+syntax_image syntax_image::open(const std::string &path) {
+    auto file = mapped_file::open(path);
+    auto image = view(file.begin(), file.size);
+    image.file = std::move(file);
+    return image;
+}
+
+std::vector<syntax> syntax_image::to_syntax() const {
+    std::vector<syntax> converted(size());
+    if (size())
+        flat_syntax::convert(*this, 0, id(size() - 1), converted);
+
+    std::vector<syntax> statements;
+    statements.reserve(head->statements);
+    for (size_t i = 0; i < head->statements; ++i)
+        statements.push_back(roots[i] == no_node ? syntax::none() : std::move(converted[roots[i]]));
+    return statements;
+}
@@ -1,6 +1,10 @@
 #pragma once
-#include <cmath>
+#include "char_scan.hpp"
+#include "symbols.hpp"
+#include "stats.hpp"
+
 #include <cassert>
+#include <charconv>
 #include <iostream>
 
 struct string_scanner {
@@ -9,25 +13,29 @@ struct string_scanner {
     const char* const end = nullptr;
 
     static string_scanner from_string(const std::string &str) {
-        return {str.data(), str.data(), str.data() + str.length()};
+        return from_range(str.data(), str.data() + str.length());
+    }
+
+    static constexpr string_scanner from_range(const char* begin, const char* end) {
+        return {begin, begin, end};
     }
 
-    bool at_end(unsigned offset = 0) {
+    constexpr bool at_end(unsigned offset = 0) {
         assert(position + offset <= end);
         return position + offset >= end;
     }
 
-    char peek(int offset = 0) {
+    constexpr char peek(int offset = 0) {
         assert(position + offset < end);
         return position[offset];
     }
 
-    void advance(unsigned offset = 1) {
+    constexpr void advance(unsigned offset = 1) {
         assert(position + offset <= end);
         position += offset;
     }
 
-    char next() {
+    constexpr char next() {
         assert(position < end);
         return (position++)[0];
     }
@@ -43,58 +51,157 @@ struct token {
         BANG_EQUAL = ('!' + '='), LESSER_EQUAL = ('<' + '='),
         EQUAL_EQUAL = ('=' + '='), GREATER_EQUAL = ('>' + '='),
         INT, FLOAT, TRUE, FALSE, IDENTIFIER,
+        FOR, STRUCT, WHILE, IF, ELSE,
         BEGIN_INPUT,
-        BAD_CHAR
+        BAD_CHAR, BAD_NUMBER
     } kind = BAD_CHAR;
 
+    // The interned IDENTIFIER, when the tokenizer has a symbol table.
+    uint32_t symbol = symbol_table::none;
+
     union {
-        ulong length = 1;
+        ulong length = 1;  // IDENTIFIER and BAD_NUMBER
         ulong int_value;
         double float_value;
     };
     const char* position = nullptr;
 
-    token(const char* position, ENUM kind) {
-        this->position = position;
-        this->kind = kind;
-    }
-    token(const char* position, char match) {
-        this->position = position;
-        kind = (ENUM)match;
-    }
-    token(const char* position, ulong value) {
-        this->position = position;
-        kind = INT;
-        int_value = value;
-    }
-    token(const char* position, double value) {
-        this->position = position;
-        kind = FLOAT;
-        float_value = value;
-    }
-    token(const char* position, bool value) {
-        this->position = position;
-        kind = value ? TRUE : FALSE;
-    }
+    // Members are initialized rather than assigned, as a constant expression
+    // may not switch the union to another member.
+    constexpr token(const char* position, ENUM kind) : kind(kind), position(position) {}
+    constexpr token(const char* position, char match) : kind((ENUM)match), position(position) {}
+    constexpr token(const char* position, ulong value) : kind(INT), int_value(value), position(position) {}
+    constexpr token(const char* position, double value) : kind(FLOAT), float_value(value), position(position) {}
+    constexpr token(const char* position, bool value) : kind(value ? TRUE : FALSE), position(position) {}
 
-    token(const char* position, char match1, char match2) {
-        this->position = position;
-        kind = ENUM(match1 + match2);
-    }
-    static token identifier(const char* position, ulong length) {
+    constexpr token(const char* position, char match1, char match2) : kind(ENUM(match1 + match2)), position(position) {}
+    static constexpr token identifier(const char* position, ulong length, uint32_t symbol = symbol_table::none) {
         auto id = token{position, IDENTIFIER}; 
         id.length = length;
+        id.symbol = symbol;
         return id;
     }
-    static token bad_char(const char* position) {
+    static constexpr token bad_number(const char* position, ulong length) {
+        auto number = token{position, BAD_NUMBER};
+        number.length = length;
+        return number;
+    }
+    static constexpr token bad_char(const char* position) {
         return token(position, BAD_CHAR);
     }
-    static token end_of_input(const char* position) {
+    static constexpr token end_of_input(const char* position) {
         return token(position, END_OF_INPUT);
     }
-    static token begin_input(const char* position) {
+    static constexpr token begin_input(const char* position) {
         return token(position, BEGIN_INPUT);
     }
+
+    static const char* name(ENUM kind) {
+        switch (kind) {
+            case END_OF_INPUT:      return "END_OF_INPUT";
+            case OPEN_PARENTHESIS:  return "(";
+            case CLOSE_PARENTHESIS: return ")";
+            case COMMA:             return ",";
+            case COLON:             return ":";
+            case SEMI_COLON:        return ";";
+            case NEW_LINE:          return "NEW_LINE";
+            case DOT:               return ".";
+            case PLUS:              return "+";
+            case MINUS:             return "-";
+            case STAR:              return "*";
+            case SLASH:             return "/";
+            case BANG:              return "!";
+            case EQUAL:             return "=";
+            case GREATER:           return ">";
+            case LESSER:            return "<";
+            case BANG_EQUAL:        return "!=";
+            case LESSER_EQUAL:      return "<=";
+            case EQUAL_EQUAL:       return "==";
+            case GREATER_EQUAL:     return ">=";
+            case INT:               return "INT";
+            case FLOAT:             return "FLOAT";
+            case TRUE:              return "TRUE";
+            case FALSE:             return "FALSE";
+            case IDENTIFIER:        return "IDENTIFIER";
+            case FOR:               return "FOR";
+            case STRUCT:            return "STRUCT";
+            case WHILE:             return "WHILE";
+            case IF:                return "IF";
+            case ELSE:              return "ELSE";
+            case BEGIN_INPUT:       return "BEGIN_INPUT";
+            case BAD_CHAR:          return "BAD_CHAR";
+            case BAD_NUMBER:        return "BAD_NUMBER";
+        }
+        return "";
+    }
+};
+
+// The reserved words, and the compile-time search for a perfect hash of them.
+struct keyword_set {
+    struct entry {
+        std::string_view word;
+        token::ENUM kind;
+    };
+
+    static constexpr entry all[] = {
+        {"else", token::ELSE}, {"false", token::FALSE}, {"for", token::FOR},
+        {"if", token::IF}, {"struct", token::STRUCT}, {"true", token::TRUE},
+        {"while", token::WHILE},
+    };
+    static constexpr size_t count = sizeof(all) / sizeof(all[0]);
+    static constexpr size_t slots = 16;
+    static constexpr size_t shortest = 2, longest = 6;
+
+    static constexpr size_t hash(const char* word, size_t length, unsigned seed) {
+        return (unsigned char)word[0] * seed + (unsigned char)word[length - 1] + length;
+    }
+
+    static constexpr unsigned find_seed() {
+        for (unsigned seed = 1; seed < 1000; ++seed) {
+            bool taken[slots] = {};
+            bool perfect = true;
+            for (auto& keyword : all) {
+                auto slot = hash(keyword.word.data(), keyword.word.size(), seed) % slots;
+                perfect &= !taken[slot];
+                taken[slot] = true;
+            }
+            if (perfect)
+                return seed;
+        }
+        return 0;
+    }
+
+    struct table_t {
+        signed char entries[slots];
+    };
+
+    static constexpr table_t build(unsigned seed) {
+        table_t table = {};
+        for (auto& slot : table.entries)
+            slot = -1;
+        for (size_t i = 0; i < count; ++i)
+            table.entries[hash(all[i].word.data(), all[i].word.size(), seed) % slots] = (signed char)i;
+        return table;
+    }
+};
+
+// A perfect hash of the reserved words, built at compile time. Every keyword
+// lands in its own slot, so recognising one is a hash and one compare.
+struct keywords : keyword_set {
+    static constexpr unsigned seed = find_seed();
+    static_assert(seed != 0, "No perfect hash seed for the keywords.");
+
+    static constexpr table_t table = build(seed);
+
+    // Returns IDENTIFIER for anything that is not a keyword.
+    static constexpr token::ENUM find(const char* word, size_t length) {
+        if (length < shortest || length > longest)
+            return token::IDENTIFIER;
+        auto entry = table.entries[hash(word, length, seed) % slots];
+        if (entry < 0 || all[entry].word != std::string_view(word, length))
+            return token::IDENTIFIER;
+        return all[entry].kind;
+    }
 };
 
 std::ostream& operator << (std::ostream& str, const token &tkn) {
@@ -122,7 +229,13 @@ std::ostream& operator << (std::ostream& str, const token &tkn) {
         case token::FLOAT:              str << tkn.float_value; break;
         case token::TRUE:               str << "true"; break;
         case token::FALSE:              str << "false"; break;
+        case token::FOR:                str << "for"; break;
+        case token::STRUCT:             str << "struct"; break;
+        case token::WHILE:              str << "while"; break;
+        case token::IF:                 str << "if"; break;
+        case token::ELSE:               str << "else"; break;
         case token::IDENTIFIER:         str << std::string_view(tkn.position, tkn.length); break;
+        case token::BAD_NUMBER:         str << std::string_view(tkn.position, tkn.length); break;
         case token::END_OF_INPUT:      str << "'End of input/file'"; break;
     }
     return str;
@@ -131,11 +244,21 @@ std::ostream& operator << (std::ostream& str, const token &tkn) {
 struct string_tokenizer {
     string_scanner scanner;
 
-    static string_tokenizer from_string(const std::string &str) {
-        return string_tokenizer{string_scanner::from_string(str)};
+    // When set, identifiers are interned and their tokens carry the symbol.
+    symbol_table* symbols = nullptr;
+
+    static string_tokenizer from_string(const std::string &str, symbol_table* symbols = nullptr) {
+        return string_tokenizer{string_scanner::from_string(str), symbols};
     }
 
-    bool consume(char match) {
+    static constexpr string_tokenizer from_range(const char* begin, const char* end, symbol_table* symbols = nullptr) {
+        return string_tokenizer{string_scanner::from_range(begin, end), symbols};
+    }
+
+    const char* begin() const { return scanner.source; }
+    const char* end() const { return scanner.end; }
+
+    constexpr bool consume(char match) {
         if (!scanner.at_end() && scanner.peek() == match) {
             scanner.advance();
             return true;
@@ -144,100 +267,145 @@ struct string_tokenizer {
     }
 
     template <int N>
-    bool consume(const char (&match)[N]) {
+    constexpr bool consume(const char (&match)[N]) {
         int offset = 0;
         while (!scanner.at_end(offset) && offset < (N - 1)) {
             if (scanner.peek(offset) != match[offset])
                 return false;
             ++offset;
         };
-        return offset == (N - 1);
+        if (offset != (N - 1))
+            return false;
+        scanner.advance(offset);
+        return true;
     }
 
-    ulong consume_int(ulong int_value = 0) {
-        while (!scanner.at_end()) {
-            int digit = scanner.peek() - '0';
-            if (0 <= digit && digit <= 9) {
-                int_value *= 10;
-                int_value += digit;
-            } else
-                break;
-            scanner.advance();
+    // Accumulates a run of digits. Returns false if the value overflowed.
+    constexpr bool consume_int(ulong &int_value) {
+        auto digits_end = char_scan::skip<char_scan::DIGIT>(scanner.position, scanner.end);
+        bool fits = true;
+        if (int_value < 10 && digits_end - scanner.position < 19) {
+            // At most 19 digits in total, which cannot overflow.
+            for (auto digit = scanner.position; digit < digits_end; ++digit)
+                int_value = int_value * 10 + ulong(*digit - '0');
+        } else {
+            for (auto digit = scanner.position; digit < digits_end; ++digit)
+                fits &= !__builtin_mul_overflow(int_value, 10, &int_value) &&
+                    !__builtin_add_overflow(int_value, ulong(*digit - '0'), &int_value);
         }
-        return int_value;
+        scanner.position = digits_end;
+        return fits;
     }
 
-    double consume_float(double float_value = 0) {
-        double factor = 0.1;
-        while (!scanner.at_end()) {
-            int digit = scanner.peek() - '0';
-            if (0 <= digit && digit <= 9) {
-                factor *= 0.1;
-                float_value = digit * factor;
-            } else
-                break;
-            scanner.advance();
+    // The largest magnitude of an INT token: 2^63, as that is LONG_MIN once
+    // the parser folds in a minus sign.
+    static constexpr ulong max_int_value = 1ul << 63;
+
+    // Doubles up to 10^22 are exact.
+    static constexpr double exact_powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    constexpr token consume_float(ulong int_value, const char* start, const char* int_end, const char* fraction, const char* fraction_end, long exponent) {
+        // With at most 19 digits the significand fits in 64 bits, and if it
+        // is at most 2^53 with |exponent| <= 22, then w * 10^e or w / 10^-e
+        // is a single correctly rounded operation on exact doubles.
+        if ((int_end - start) + (fraction_end - fraction) <= 19) {
+            ulong significand = int_value;
+            for (auto digit = fraction; digit < fraction_end; ++digit)
+                significand = significand * 10 + ulong(*digit - '0');
+            exponent -= fraction_end - fraction;
+
+            if (significand <= (1ul << 53) && -22 <= exponent && exponent <= 22) {
+                double value = double(significand);
+                value = exponent < 0 ? value / exact_powers_of_ten[-exponent] : value * exact_powers_of_ten[exponent];
+                return token(start, value);
+            }
         }
-        return float_value;
+
+        // Everything else goes through from_chars, which is correctly
+        // rounded (Eisel-Lemire with a big number fallback) and allocation free,
+        // but not a constant expression, so static_parser rejects these.
+        double value = 0;
+        auto result = std::from_chars(start, scanner.position, value);
+        if (result.ec != std::errc() || result.ptr != scanner.position)
+            return token::bad_number(start, ulong(scanner.position - start));
+        return token(start, value);
     }
 
-    token consume_number(ulong int_value) {
-        auto position = scanner.position - 1;
-        int_value = consume_int(int_value);
+    // number → digits ("." digits?)? (("E" | "e") ("+" | "-")? digits)?
+    // Numbers without a fraction or negative exponent are INT tokens, and
+    // numbers out of range become BAD_NUMBER tokens.
+    constexpr token consume_number(ulong int_value) {
+        auto start = scanner.position - 1;
+        bool fits = consume_int(int_value);
+        auto int_end = scanner.position;
 
+        const char* fraction = nullptr, *fraction_end = nullptr;
         if (consume('.')) {
-            double float_value = consume_float(int_value);
-
-            if (!consume('E') && !consume('e'))
-                return token(position, float_value);
-
-            int sign = consume('+') || !consume('-') ? 1 : -1;
-            float_value *= pow(10, sign * consume_int(0));
-            return token(position, float_value);
+            fraction = scanner.position;
+            fraction_end = scanner.position = char_scan::skip<char_scan::DIGIT>(scanner.position, scanner.end);
         }
 
-        if (!consume('E') && !consume('e'))
-            return token(position, int_value);
-        
-        if (consume('-')) {
-            double float_value = int_value;
-            float_value *= pow(10, -consume_int(0));
-            return token(position, float_value);
+        long exponent = 0;
+        if (!scanner.at_end() && (scanner.peek() == 'e' || scanner.peek() == 'E')) {
+            auto exponent_start = scanner.position;
+            scanner.advance();
+            bool negative = consume('-');
+            if (!negative)
+                consume('+');
+            ulong magnitude = 0;
+            auto digits = scanner.position;
+            bool small = consume_int(magnitude) && magnitude < 100000;
+            if (scanner.position == digits)
+                scanner.position = exponent_start;  // Not an exponent after all.
+            else
+                exponent = negative ? -long(small ? magnitude : 100000) : long(small ? magnitude : 100000);
         }
 
-        consume('+');
-        int_value *= pow(10, consume_int(0));
-        return token(position, int_value);
+        if (fraction || exponent < 0)
+            return consume_float(int_value, start, int_end, fraction, fraction_end, exponent);
+
+        for (long i = 0; i < exponent && fits && int_value; ++i)
+            fits = !__builtin_mul_overflow(int_value, 10, &int_value);
+        if (!fits || int_value > max_int_value)
+            return token::bad_number(start, ulong(scanner.position - start));
+        return token(start, int_value);
     }
 
-    token consume_identifier_or_bad_char() {
-        char prev = scanner.peek(-1);
-        if (!(prev == '_' ||
-            ('0' <= prev && prev <= '9') ||
-            ('a' <= prev && prev <= 'z') ||
-            ('A' <= prev && prev <= 'Z')
-        )) return token::bad_char(scanner.position - 1);
+    constexpr token consume_identifier_or_bad_char() {
+        if (!char_scan::is<char_scan::IDENTIFIER>(scanner.peek(-1)))
+            return token::bad_char(scanner.position - 1);
         
         auto start = scanner.position - 1;
-        while (!scanner.at_end()) {
-            char next = scanner.peek();
-            if (next == '_' ||
-                ('0' <= next && next <= '9') ||
-                ('a' <= next && next <= 'z') ||
-                ('A' <= next && next <= 'Z')
-            ) scanner.advance();
-            else
-                break;
-        }
-        return token::identifier(start, ulong(scanner.position - start));
+        scanner.position = char_scan::skip<char_scan::IDENTIFIER>(scanner.position, scanner.end);
+        auto length = ulong(scanner.position - start);
+
+        auto kind = keywords::find(start, length);
+        if (kind != token::IDENTIFIER)
+            return token(start, kind);
+        if (symbols)
+            return token::identifier(start, length, symbols->intern(start, length));
+        return token::identifier(start, length);
     }
 
     token next() {
+        parser_stats::phase timed(&parser_stats::tokenize_ns);
+        auto next = scan();
+        parser_stats::token(next.kind);
+        return next;
+    }
+
+    // Also a constant expression, for static_parser, as long as the tokenizer
+    // has no symbol table.
+    constexpr token scan() {
         while (!scanner.at_end()) {
             auto next = scanner.next();
             switch (next) {
                 // Skip characters
                 case ' ': case '\t': case '\r':
+                    scanner.position = char_scan::skip<char_scan::BLANK>(scanner.position, scanner.end);
                     continue;
                 // Single characters
                 case '(': case ')': case '+': case '-': case '*': case '/':
@@ -250,10 +418,7 @@ struct string_tokenizer {
                 case '0': case '1': case '2': case '3': case '4':
                 case '5': case '6': case '7': case '8': case '9':
                     return consume_number(next - '0');
-                // Multi characters
-                case 'f': return consume("alse") ? token(scanner.position - 1, false) : consume_identifier_or_bad_char();
-                case 't': return consume("rue")  ? token(scanner.position - 1, true)  : consume_identifier_or_bad_char();
-                // Identifiers (or bad characters)
+                // Identifiers, keywords (or bad characters)
                 default: return consume_identifier_or_bad_char();
             }
         }
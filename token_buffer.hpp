@@ -0,0 +1,156 @@
+#pragma once
+#include "token.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// The tokens of a whole input, tokenized up front into parallel arrays: a
+// byte per kind and a 32-bit source offset per token, with numbers and
+// identifiers keeping their payload in side tables. Any token can be read
+// back by index, so the buffer can be parsed again or walked by tools
+// without tokenizing the input twice.
+struct token_buffer {
+    struct name {
+        uint32_t length;
+        uint32_t symbol;
+    };
+
+    union number {
+        ulong int_value;
+        double float_value;
+    };
+
+    const char* source = nullptr;
+    const char* source_end = nullptr;
+
+    std::vector<uint8_t> kinds;
+    std::vector<uint32_t> offsets;
+    // The index into names for IDENTIFIER and BAD_NUMBER tokens, or into
+    // numbers for INT and FLOAT tokens.
+    std::vector<uint32_t> payloads;
+    std::vector<name> names;
+    std::vector<number> numbers;
+
+    struct cursor;
+
+    static token_buffer from_string(const std::string &str, symbol_table* symbols = nullptr) {
+        return from_range(str.data(), str.data() + str.length(), symbols);
+    }
+
+    static token_buffer from_range(const char* begin, const char* end, symbol_table* symbols = nullptr) {
+        token_buffer buffer;
+        buffer.tokenize(begin, end, symbols);
+        return buffer;
+    }
+
+    // Replaces the contents with the tokens of [begin, end), keeping the
+    // capacity of the arrays. The last token is always END_OF_INPUT.
+    void tokenize(const char* begin, const char* end, symbol_table* symbols = nullptr) {
+        if (size_t(end - begin) >= UINT32_MAX)
+            throw std::length_error("token_buffer inputs must be smaller than 4 GiB.");
+        parser_stats::phase timed(&parser_stats::tokenize_ns);
+        clear();
+        source = begin;
+        source_end = end;
+        kinds.reserve(size_t(end - begin) / 4);
+        offsets.reserve(size_t(end - begin) / 4);
+        payloads.reserve(size_t(end - begin) / 4);
+
+        auto tokenizer = string_tokenizer::from_range(begin, end, symbols);
+        for (;;) {
+            auto next = tokenizer.next();
+            append(next);
+            if (next.kind == token::END_OF_INPUT)
+                break;
+        }
+    }
+
+    void append(const token &tkn) {
+        uint32_t payload = 0;
+        switch (tkn.kind) {
+            case token::IDENTIFIER:
+            case token::BAD_NUMBER:
+                payload = uint32_t(names.size());
+                names.push_back({uint32_t(tkn.length), tkn.symbol});
+                break;
+            case token::INT:
+                payload = uint32_t(numbers.size());
+                numbers.emplace_back().int_value = tkn.int_value;
+                break;
+            case token::FLOAT:
+                payload = uint32_t(numbers.size());
+                numbers.emplace_back().float_value = tkn.float_value;
+                break;
+            default:
+                break;
+        }
+        kinds.push_back(uint8_t(tkn.kind));
+        offsets.push_back(uint32_t(tkn.position - source));
+        payloads.push_back(payload);
+    }
+
+    void clear() {
+        kinds.clear();
+        offsets.clear();
+        payloads.clear();
+        names.clear();
+        numbers.clear();
+    }
+
+    size_t size() const { return kinds.size(); }
+    token::ENUM kind(size_t i) const { return (token::ENUM)kinds[i]; }
+    const char* position(size_t i) const { return source + offsets[i]; }
+
+    // Rebuilds the i-th token. Past the end this is END_OF_INPUT.
+    token operator[](size_t i) const {
+        if (i >= size())
+            return token::end_of_input(source_end);
+        auto tkn = token(position(i), kind(i));
+        switch (tkn.kind) {
+            case token::IDENTIFIER:
+                tkn.length = names[payloads[i]].length;
+                tkn.symbol = names[payloads[i]].symbol;
+                break;
+            case token::BAD_NUMBER:
+                tkn.length = names[payloads[i]].length;
+                break;
+            case token::INT:
+                tkn.int_value = numbers[payloads[i]].int_value;
+                break;
+            case token::FLOAT:
+                tkn.float_value = numbers[payloads[i]].float_value;
+                break;
+            default:
+                break;
+        }
+        return tkn;
+    }
+};
+
+// Reads a token_buffer in order, in place of a string_tokenizer. Any number
+// of tokens ahead can be peeked at, and the buffer is left untouched, so
+// several cursors can read the same buffer.
+struct token_buffer::cursor {
+    const token_buffer* buffer = nullptr;
+    size_t index = 0;
+
+    cursor(const token_buffer& buffer) : buffer(&buffer) {}
+
+    token next() {
+        return (*buffer)[index++];
+    }
+
+    token peek(size_t ahead = 0) const {
+        return (*buffer)[index + ahead];
+    }
+
+    // The kind of a token ahead, read from the buffer without rebuilding it.
+    token::ENUM kind(size_t ahead = 0) const {
+        auto i = index + ahead;
+        return i < buffer->size() ? buffer->kind(i) : token::END_OF_INPUT;
+    }
+
+    const char* begin() const { return buffer->source; }
+    const char* end() const { return buffer->source_end; }
+};